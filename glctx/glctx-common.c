@@ -1,6 +1,96 @@
-#include "glctx.h"
+#include "glctx-private.h"
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#if !GLCTX_MSWIN
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#if defined(_MSC_VER)
+#define GLCTX_THREAD_LOCAL __declspec(thread)
+#else
+#define GLCTX_THREAD_LOCAL __thread
+#endif
+
+static GLCTX_THREAD_LOCAL GlctxHandle glctx_current = NULL;
+
+GlctxHandle glctx_get_current(void)
+{
+    return glctx_current;
+}
+
+void glctx__set_current(GlctxHandle ctx)
+{
+    glctx_current = ctx;
+}
+
+typedef struct {
+    void (*func)(void *arg);
+    void *arg;
+} GlctxThreadStart;
+
+#if GLCTX_MSWIN
+static DWORD WINAPI glctx_thread_main(LPVOID data)
+#else
+static void *glctx_thread_main(void *data)
+#endif
+{
+    GlctxThreadStart start = *(GlctxThreadStart *) data;
+
+    free(data);
+    start.func(start.arg);
+    return 0;
+}
+
+GlctxError glctx__thread_start(GlctxThread *thread,
+        void (*func)(void *arg), void *arg)
+{
+    GlctxThreadStart *start = malloc(sizeof(GlctxThreadStart));
+
+    if (!start)
+        return GLCTX_ERROR_MEMORY;
+    start->func = func;
+    start->arg = arg;
+#if GLCTX_MSWIN
+    *thread = CreateThread(NULL, 0, glctx_thread_main, start, 0, NULL);
+    if (*thread)
+        return GLCTX_ERROR_NONE;
+#else
+    if (!pthread_create(thread, NULL, glctx_thread_main, start))
+        return GLCTX_ERROR_NONE;
+#endif
+    glctx__log("glctx: Unable to start thread\n");
+    free(start);
+    return GLCTX_ERROR_MEMORY;
+}
+
+double glctx__now_us(void)
+{
+#if GLCTX_MSWIN
+    LARGE_INTEGER freq, count;
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double) count.QuadPart * 1e6 / (double) freq.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1e6 + (double) ts.tv_nsec / 1e3;
+#endif
+}
+
+void glctx__thread_join(GlctxThread thread)
+{
+#if GLCTX_MSWIN
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_join(thread, NULL);
+#endif
+}
 
 int glctx__log_ignore(const char *format, ...)
 {
@@ -39,12 +129,30 @@ const char *glctx_get_error_name(GlctxError err)
             return "GLCTX_ERROR_BIND";
         case GLCTX_ERROR_PROFILE:
             return "GLCTX_ERROR_PROFILE";
+        case GLCTX_ERROR_UNSUPPORTED:
+            return "GLCTX_ERROR_UNSUPPORTED";
+        case GLCTX_ERROR_TIMEOUT:
+            return "GLCTX_ERROR_TIMEOUT";
+        case GLCTX_ERROR_BUSY:
+            return "GLCTX_ERROR_BUSY";
         default:
             break;
     }
     return "GLCTX_ERROR_UNKNOWN";
 }
 
+int glctx__check_context_flags(int flags)
+{
+    if ((flags & GLCTX_CONTEXT_NO_ERROR) &&
+            (flags & (GLCTX_CONTEXT_DEBUG | GLCTX_CONTEXT_ROBUST)))
+    {
+        glctx__log("glctx: Ignoring GLCTX_CONTEXT_NO_ERROR with "
+                "debug/robust context\n");
+        flags &= ~GLCTX_CONTEXT_NO_ERROR;
+    }
+    return flags;
+}
+
 int *glctx__make_attrs_buffer(const int *attrs,
         const int *native_attrs, int native_attr_term)
 {
@@ -65,3 +173,1130 @@ int *glctx__make_attrs_buffer(const int *attrs,
     return malloc(sizeof(int) * n_attrs);
 }
 
+
+int glctx__supports_extension(const char *extensions, const char *ext)
+{
+    const char *start;
+    const char *where, *term;
+
+    if (!extensions)
+        return 0;
+    for (start = extensions;;)
+    {
+        where = strstr(start, ext);
+        if (!where)
+            break;
+        term = where + strlen(ext);
+        if ((where == start || *(where - 1) == ' ') &&
+                (*term == ' ' || !*term))
+        {
+            return 1;
+        }
+        start = term;
+    }
+    return 0;
+}
+
+GlctxError glctx_create_shared_contexts(GlctxHandle ctx, int n,
+        GlctxHandle *workers)
+{
+    GlctxError result;
+    int i;
+
+    for (i = 0; i < n; ++i)
+    {
+        result = glctx_create_shared(ctx, &workers[i]);
+        if (result)
+        {
+            while (i-- > 0)
+            {
+                glctx_terminate(workers[i]);
+                workers[i] = NULL;
+            }
+            return result;
+        }
+    }
+    return GLCTX_ERROR_NONE;
+}
+
+void glctx__set_size(GlctxSizeCache *size, int width, int height)
+{
+    glctx__atomic_store_int(&size->width, width);
+    glctx__atomic_store_int(&size->height, height);
+    glctx__atomic_store_int(&size->stale, 0);
+}
+
+static GlctxSizeCache *glctx_get_fresh_size(GlctxHandle ctx)
+{
+    GlctxSizeCache *size = glctx__get_size_cache(ctx);
+    int width, height;
+
+    if (glctx__atomic_load_int(&size->stale) &&
+            glctx__atomic_cas_int(&size->stale, 1, 0) &&
+            glctx__query_size(ctx, &width, &height))
+    {
+        glctx__atomic_store_int(&size->width, width);
+        glctx__atomic_store_int(&size->height, height);
+    }
+    return size;
+}
+
+int glctx_get_width(GlctxHandle ctx)
+{
+    return glctx__atomic_load_int(&glctx_get_fresh_size(ctx)->width);
+}
+
+int glctx_get_height(GlctxHandle ctx)
+{
+    return glctx__atomic_load_int(&glctx_get_fresh_size(ctx)->height);
+}
+
+void glctx_notify_resize(GlctxHandle ctx, int width, int height)
+{
+    GlctxSizeCache *size = glctx__get_size_cache(ctx);
+
+    if (width > 0 && height > 0)
+        glctx__set_size(size, width, height);
+    else
+        glctx__atomic_store_int(&size->stale, 1);
+}
+
+/*
+ * Pooled workers live in a fixed array of slots. Acquiring swaps a slot's
+ * handle for NULL and releasing swaps NULL for a handle; there's no ABA
+ * problem because a pooled handle is never freed while the pool is in use.
+ * Searches start at a rotating index to spread contention.
+ */
+struct GlctxPool_ {
+    GlctxHandle parent;
+    int size;
+    GlctxAtomicInt next;
+    void *volatile slots[1];
+};
+
+GlctxError glctx_pool_create(GlctxHandle ctx, int size, GlctxPool *ppool)
+{
+    GlctxPool pool;
+    GlctxError result;
+    int i;
+
+    *ppool = NULL;
+    if (size < 1)
+        size = 1;
+    pool = calloc(1, sizeof(struct GlctxPool_) +
+            sizeof(void *) * (size - 1));
+    if (!pool)
+        return GLCTX_ERROR_MEMORY;
+    pool->parent = ctx;
+    pool->size = size;
+    for (i = 0; i < size; ++i)
+    {
+        GlctxHandle worker;
+
+        result = glctx_create_shared(ctx, &worker);
+        if (result)
+        {
+            glctx_pool_destroy(pool);
+            return result;
+        }
+        pool->slots[i] = worker;
+    }
+    glctx__log("glctx: Created pool of %d contexts\n", size);
+    *ppool = pool;
+    return GLCTX_ERROR_NONE;
+}
+
+static unsigned glctx_pool_start(GlctxPool pool)
+{
+    return (unsigned) glctx__atomic_add_int(&pool->next, 1) %
+            (unsigned) pool->size;
+}
+
+GlctxError glctx_pool_acquire(GlctxPool pool, GlctxHandle *pctx)
+{
+    unsigned start = glctx_pool_start(pool);
+    GlctxError result;
+    int i;
+
+    *pctx = NULL;
+    for (i = 0; i < pool->size; ++i)
+    {
+        void *volatile *slot = &pool->slots[(start + i) % pool->size];
+        void *worker = glctx__atomic_load_ptr(slot);
+
+        if (worker && glctx__atomic_cas_ptr(slot, worker, NULL))
+        {
+            *pctx = worker;
+            break;
+        }
+    }
+    if (!*pctx)
+    {
+        glctx__log("glctx: Context pool is empty, creating a context\n");
+        result = glctx_create_shared(pool->parent, pctx);
+        if (result)
+            return result;
+    }
+    result = glctx_bind(*pctx);
+    if (result)
+    {
+        glctx_pool_release(pool, *pctx);
+        *pctx = NULL;
+    }
+    return result;
+}
+
+void glctx_pool_release(GlctxPool pool, GlctxHandle ctx)
+{
+    unsigned start = glctx_pool_start(pool);
+    int i;
+
+    glctx_unbind(ctx);
+    for (i = 0; i < pool->size; ++i)
+    {
+        void *volatile *slot = &pool->slots[(start + i) % pool->size];
+
+        if (!glctx__atomic_load_ptr(slot) &&
+                glctx__atomic_cas_ptr(slot, NULL, ctx))
+        {
+            return;
+        }
+    }
+    glctx_terminate(ctx);
+}
+
+void glctx_pool_destroy(GlctxPool pool)
+{
+    int i;
+
+    if (!pool)
+        return;
+    for (i = 0; i < pool->size; ++i)
+    {
+        if (pool->slots[i])
+            glctx_terminate(pool->slots[i]);
+    }
+    free(pool);
+}
+
+void glctx_free_configs(GlctxConfigInfo *infos)
+{
+    free(infos);
+}
+
+int glctx_config_info_attr(const GlctxConfigInfo *info, GlctxAttr attr)
+{
+    switch (attr)
+    {
+        case GLCTX_CFG_RED_SIZE:
+            return info->red_size;
+        case GLCTX_CFG_GREEN_SIZE:
+            return info->green_size;
+        case GLCTX_CFG_BLUE_SIZE:
+            return info->blue_size;
+        case GLCTX_CFG_ALPHA_SIZE:
+            return info->alpha_size;
+        case GLCTX_CFG_DEPTH_SIZE:
+            return info->depth_size;
+        case GLCTX_CFG_STENCIL_SIZE:
+            return info->stencil_size;
+        default:
+            break;
+    }
+    return -1;
+}
+
+static const GlctxConfigWeights glctx_default_config_weights = {
+    4,      /* color */
+    2,      /* alpha */
+    1,      /* depth */
+    1,      /* stencil */
+    8,      /* samples */
+    1000    /* single_buffer */
+};
+
+void glctx_get_default_config_weights(GlctxConfigWeights *weights)
+{
+    *weights = glctx_default_config_weights;
+}
+
+static int glctx_abs_diff(int a, int b)
+{
+    return a > b ? a - b : b - a;
+}
+
+static int glctx_excess(int a, int b)
+{
+    return a > b ? a - b : 0;
+}
+
+int glctx_score_config(const GlctxConfigInfo *info,
+        const int *attrs, int samples, const GlctxConfigWeights *weights)
+{
+    int wanted[GLCTX_CFG_STENCIL_SIZE + 1] = { 0, 8, 8, 8, 0, 0, 0 };
+    int score = 0;
+    int n;
+
+    if (!weights)
+        weights = &glctx_default_config_weights;
+    if (attrs)
+    {
+        for (n = 0; attrs[n]; n += 2)
+        {
+            if (attrs[n] > 0 && attrs[n] <= GLCTX_CFG_STENCIL_SIZE)
+                wanted[attrs[n]] = attrs[n + 1];
+        }
+    }
+    score += weights->color * (
+            glctx_abs_diff(info->red_size, wanted[GLCTX_CFG_RED_SIZE]) +
+            glctx_abs_diff(info->green_size, wanted[GLCTX_CFG_GREEN_SIZE]) +
+            glctx_abs_diff(info->blue_size, wanted[GLCTX_CFG_BLUE_SIZE]));
+    score += weights->alpha *
+            glctx_excess(info->alpha_size, wanted[GLCTX_CFG_ALPHA_SIZE]);
+    score += weights->depth *
+            glctx_excess(info->depth_size, wanted[GLCTX_CFG_DEPTH_SIZE]);
+    score += weights->stencil *
+            glctx_excess(info->stencil_size, wanted[GLCTX_CFG_STENCIL_SIZE]);
+    score += weights->samples * glctx_abs_diff(info->samples, samples);
+    if (!info->double_buffer)
+        score += weights->single_buffer;
+    return score;
+}
+
+/* Whether info meets attrs' minimum sizes, like the window system's search */
+static int glctx_config_satisfies(const GlctxConfigInfo *info,
+        const int *attrs)
+{
+    int n;
+
+    if (!attrs)
+        return 1;
+    for (n = 0; attrs[n]; n += 2)
+    {
+        int size = glctx_config_info_attr(info, attrs[n]);
+
+        if (size >= 0 && size < attrs[n + 1])
+            return 0;
+    }
+    return 1;
+}
+
+static char *glctx_config_cache_path = NULL;
+
+GlctxError glctx_set_config_cache(const char *path)
+{
+    free(glctx_config_cache_path);
+    glctx_config_cache_path = NULL;
+    if (path)
+    {
+        size_t len = strlen(path) + 1;
+
+        glctx_config_cache_path = malloc(len);
+        if (!glctx_config_cache_path)
+            return GLCTX_ERROR_MEMORY;
+        memcpy(glctx_config_cache_path, path, len);
+    }
+    return GLCTX_ERROR_NONE;
+}
+
+/* 64-bit FNV-1a */
+static unsigned long long glctx_hash_bytes(unsigned long long hash,
+        const void *data, size_t len)
+{
+    const unsigned char *bytes = data;
+    size_t n;
+
+    for (n = 0; n < len; ++n)
+    {
+        hash ^= bytes[n];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static unsigned long long glctx_hash_int(unsigned long long hash, int i)
+{
+    return glctx_hash_bytes(hash, &i, sizeof(i));
+}
+
+static unsigned long long glctx_hash_string(unsigned long long hash,
+        const char *s)
+{
+    /* Include the NUL so adjacent strings can't run together */
+    return s ? glctx_hash_bytes(hash, s, strlen(s) + 1) :
+            glctx_hash_bytes(hash, "", 1);
+}
+
+static unsigned long long glctx_config_cache_key(GlctxHandle ctx,
+        const int *attrs, int samples, const GlctxConfigWeights *weights)
+{
+    char driver[1024];
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+    int n;
+
+    glctx__describe_driver(ctx, driver, sizeof(driver));
+    hash = glctx_hash_string(hash, driver);
+    /* The renderer is only known once there's a context */
+    if (glctx_get_current() == ctx)
+    {
+        GlctxGLProc_GetString get_string = GLCTX_GL(ctx, GetString);
+
+        if (get_string)
+        {
+            hash = glctx_hash_string(hash,
+                    (const char *) get_string(0x1F01 /* GL_RENDERER */));
+            hash = glctx_hash_string(hash,
+                    (const char *) get_string(0x1F02 /* GL_VERSION */));
+        }
+    }
+    if (attrs)
+    {
+        for (n = 0; attrs[n]; n += 2)
+        {
+            hash = glctx_hash_int(hash, attrs[n]);
+            hash = glctx_hash_int(hash, attrs[n + 1]);
+        }
+    }
+    hash = glctx_hash_int(hash, GLCTX_CFG_NONE);
+    hash = glctx_hash_int(hash, samples);
+    hash = glctx_hash_int(hash, weights->color);
+    hash = glctx_hash_int(hash, weights->alpha);
+    hash = glctx_hash_int(hash, weights->depth);
+    hash = glctx_hash_int(hash, weights->stencil);
+    hash = glctx_hash_int(hash, weights->samples);
+    hash = glctx_hash_int(hash, weights->single_buffer);
+    return hash;
+}
+
+/* Returns non-zero if found. Later entries override earlier ones. */
+static int glctx_config_cache_lookup(unsigned long long key,
+        int *id, int *score)
+{
+    FILE *fp = fopen(glctx_config_cache_path, "r");
+    char line[64];
+    int found = 0;
+
+    if (!fp)
+        return 0;
+    while (fgets(line, sizeof(line), fp))
+    {
+        unsigned long long k;
+        int i, sc;
+
+        /* Entries without a score predate validation, so ignore them */
+        if (sscanf(line, "%llx %d %d", &k, &i, &sc) == 3 && k == key)
+        {
+            *id = i;
+            *score = sc;
+            found = 1;
+        }
+    }
+    fclose(fp);
+    return found;
+}
+
+/* Plenty for a few drivers and apps, while keeping lookups quick */
+#define GLCTX_CONFIG_CACHE_MAX 256
+
+typedef struct {
+    unsigned long long key;
+    int id, score;
+} GlctxConfigCacheEntry;
+
+/* Returns non-zero on success */
+static int glctx_replace_file(const char *from, const char *to)
+{
+#if GLCTX_MSWIN
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(from, to) == 0;
+#endif
+}
+
+/*
+ * Rewrites the file with this entry last, dropping older entries for the
+ * same key and malformed lines, and keeping only the newest entries so the
+ * file can't grow forever. The file is replaced by renaming a temporary one
+ * so other processes never see it half written; if two processes store at
+ * once one entry may be lost, and is found again next time.
+ */
+static void glctx_config_cache_store(unsigned long long key,
+        int id, int score)
+{
+    GlctxConfigCacheEntry entries[GLCTX_CONFIG_CACHE_MAX - 1];
+    int max_entries = GLCTX_CONFIG_CACHE_MAX - 1;
+    int n_entries = 0, first = 0;
+    const char *path = glctx_config_cache_path;
+    char *tmp_path;
+    char line[64];
+    FILE *fp;
+    int failed;
+    int n;
+
+    fp = fopen(path, "r");
+    if (fp)
+    {
+        /* entries is a ring holding the newest lines */
+        while (fgets(line, sizeof(line), fp))
+        {
+            GlctxConfigCacheEntry e;
+
+            if (sscanf(line, "%llx %d %d", &e.key, &e.id, &e.score) != 3 ||
+                    e.key == key)
+            {
+                continue;
+            }
+            if (n_entries < max_entries)
+            {
+                entries[(first + n_entries++) % max_entries] = e;
+            }
+            else
+            {
+                entries[first] = e;
+                first = (first + 1) % max_entries;
+            }
+        }
+        fclose(fp);
+    }
+
+    tmp_path = malloc(strlen(path) + 32);
+    if (!tmp_path)
+        return;
+    sprintf(tmp_path, "%s.%lu.tmp", path,
+#if GLCTX_MSWIN
+            (unsigned long) GetCurrentProcessId());
+#else
+            (unsigned long) getpid());
+#endif
+    fp = fopen(tmp_path, "w");
+    if (!fp)
+    {
+        glctx__log("glctx: Unable to write config cache '%s'\n", tmp_path);
+        free(tmp_path);
+        return;
+    }
+    for (n = 0; n < n_entries; ++n)
+    {
+        const GlctxConfigCacheEntry *e = &entries[(first + n) % max_entries];
+
+        fprintf(fp, "%016llx %d %d\n", e->key, e->id, e->score);
+    }
+    fprintf(fp, "%016llx %d %d\n", key, id, score);
+    failed = ferror(fp);
+    if (fclose(fp))
+        failed = 1;
+    if (failed || !glctx_replace_file(tmp_path, path))
+    {
+        glctx__log("glctx: Unable to write config cache '%s'\n", path);
+        remove(tmp_path);
+    }
+    free(tmp_path);
+}
+
+GlctxError glctx_choose_config(GlctxHandle ctx, GlctxConfig *cfg_out,
+        const int *attrs, int native_attrs,
+        int samples, const GlctxConfigWeights *weights)
+{
+    GlctxConfigInfo *infos;
+    int n_infos;
+    int best = -1;
+    int best_score = 0;
+    int n;
+    /* Native attrs' terminator depends on the backend, so don't cache them */
+    int use_cache = glctx_config_cache_path && !native_attrs;
+    unsigned long long key = 0;
+    GlctxError result;
+
+    if (!weights)
+        weights = &glctx_default_config_weights;
+    if (use_cache)
+    {
+        int id;
+
+        key = glctx_config_cache_key(ctx, attrs, samples, weights);
+        if (glctx_config_cache_lookup(key, &id, &best_score) &&
+                glctx_get_config_by_id(ctx, id, cfg_out) == GLCTX_ERROR_NONE)
+        {
+            GlctxConfigInfo info;
+
+            glctx__get_config_info(ctx, *cfg_out, &info);
+            if (glctx_config_satisfies(&info, attrs) &&
+                    glctx_score_config(&info, attrs, samples, weights) ==
+                    best_score)
+            {
+                glctx__log("glctx: Using cached config ID %d\n", id);
+                return GLCTX_ERROR_NONE;
+            }
+            glctx__log("glctx: Cached config ID %d no longer matches\n", id);
+        }
+    }
+
+    result = glctx_enumerate_configs(ctx, attrs, native_attrs,
+            &infos, &n_infos);
+    if (result)
+    {
+        glctx__log("glctx: No matching configs available\n");
+        return result;
+    }
+    /* Native attrs can't be interpreted, so score against defaults */
+    if (native_attrs)
+        attrs = NULL;
+    for (n = 0; n < n_infos; ++n)
+    {
+        const GlctxConfigInfo *info = &infos[n];
+        int score = glctx_score_config(info, attrs, samples, weights);
+
+        if (best < 0 || score < best_score)
+        {
+            best = n;
+            best_score = score;
+        }
+        glctx__log("glctx: Config ID %d, RGBA(%d%d%d%d), depth %d, "
+                "stencil %d, samples %d: score %d\n",
+                info->id, info->red_size, info->green_size, info->blue_size,
+                info->alpha_size, info->depth_size, info->stencil_size,
+                info->samples, score);
+    }
+    glctx__log("glctx: Chose config ID %d\n", infos[best].id);
+    *cfg_out = infos[best].config;
+    if (use_cache)
+        glctx_config_cache_store(key, infos[best].id, best_score);
+    glctx_free_configs(infos);
+    return GLCTX_ERROR_NONE;
+}
+
+typedef struct {
+    char *name;
+    GlctxProc proc;
+} GlctxProcEntry;
+
+/* Set of extension names, with open addressing */
+typedef struct {
+    char *names;            /* All names, each NUL-terminated */
+    const char **slots;     /* size is a power of 2 */
+    unsigned int size;
+    int built;
+} GlctxExtSet;
+
+struct GlctxDispatch_ {
+    GlctxProcEntry *entries;    /* Open addressing, size is a power of 2 */
+    unsigned int size;
+    unsigned int count;
+    GlctxProc gl[GLCTX_GL_N_PROCS];
+    char gl_resolved[GLCTX_GL_N_PROCS];
+    GlctxExtSet gl_extensions;
+    int gl_sync;                /* -1 until checked */
+};
+
+static const char *glctx_gl_proc_names[] = {
+#define GLCTX_GL_PROC(ret, name, params) "gl" #name,
+    GLCTX_GL_PROCS
+#undef GLCTX_GL_PROC
+};
+
+static unsigned int glctx_hash_name(const char *name)
+{
+    unsigned int hash = 2166136261u;
+
+    for (; *name; ++name)
+    {
+        hash ^= (unsigned char) *name;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static GlctxDispatch *glctx_get_dispatch(GlctxHandle ctx)
+{
+    GlctxDispatch **pdispatch = glctx__get_dispatch(ctx);
+
+    if (!*pdispatch)
+    {
+        *pdispatch = calloc(1, sizeof(GlctxDispatch));
+        if (*pdispatch)
+            (*pdispatch)->gl_sync = -1;
+    }
+    return *pdispatch;
+}
+
+static void glctx_ext_set_free(GlctxExtSet *set)
+{
+    free(set->names);
+    free((void *) set->slots);
+    set->names = NULL;
+    set->slots = NULL;
+    set->size = 0;
+}
+
+void glctx__free_dispatch(GlctxDispatch *dispatch)
+{
+    unsigned int n;
+
+    if (!dispatch)
+        return;
+    glctx_ext_set_free(&dispatch->gl_extensions);
+    for (n = 0; n < dispatch->size; ++n)
+        free(dispatch->entries[n].name);
+    free(dispatch->entries);
+    free(dispatch);
+}
+
+static GlctxProcEntry *glctx_find_proc_entry(GlctxProcEntry *entries,
+        unsigned int size, const char *name)
+{
+    unsigned int n = glctx_hash_name(name) & (size - 1);
+
+    while (entries[n].name && strcmp(entries[n].name, name))
+        n = (n + 1) & (size - 1);
+    return &entries[n];
+}
+
+/* Keeps the load factor under 1/2 */
+static int glctx_grow_dispatch(GlctxDispatch *dispatch)
+{
+    unsigned int size = dispatch->size ? dispatch->size * 2 : 64;
+    GlctxProcEntry *entries = calloc(size, sizeof(GlctxProcEntry));
+    unsigned int n;
+
+    if (!entries)
+        return 0;
+    for (n = 0; n < dispatch->size; ++n)
+    {
+        GlctxProcEntry *old = &dispatch->entries[n];
+
+        if (old->name)
+            *glctx_find_proc_entry(entries, size, old->name) = *old;
+    }
+    free(dispatch->entries);
+    dispatch->entries = entries;
+    dispatch->size = size;
+    return 1;
+}
+
+GlctxProc glctx_get_proc_address(GlctxHandle ctx, const char *name)
+{
+    GlctxDispatch *dispatch = glctx_get_dispatch(ctx);
+    GlctxProcEntry *entry;
+    size_t len;
+
+    if (!dispatch)
+        return glctx__get_native_proc(name);
+    if (dispatch->size)
+    {
+        entry = glctx_find_proc_entry(dispatch->entries, dispatch->size, name);
+        if (entry->name)
+            return entry->proc;
+    }
+    if ((dispatch->count + 1) * 2 > dispatch->size &&
+            !glctx_grow_dispatch(dispatch))
+    {
+        return glctx__get_native_proc(name);
+    }
+    entry = glctx_find_proc_entry(dispatch->entries, dispatch->size, name);
+    len = strlen(name) + 1;
+    entry->name = malloc(len);
+    if (!entry->name)
+        return glctx__get_native_proc(name);
+    memcpy(entry->name, name, len);
+    entry->proc = glctx__get_native_proc(name);
+    ++dispatch->count;
+    return entry->proc;
+}
+
+GlctxProc glctx__gl_proc(GlctxHandle ctx, GlctxGLProcId id)
+{
+    GlctxDispatch *dispatch = glctx_get_dispatch(ctx);
+
+    if (!dispatch)
+        return glctx__get_native_proc(glctx_gl_proc_names[id]);
+    if (!dispatch->gl_resolved[id])
+    {
+        dispatch->gl[id] = glctx_get_proc_address(ctx,
+                glctx_gl_proc_names[id]);
+        dispatch->gl_resolved[id] = 1;
+    }
+    return dispatch->gl[id];
+}
+
+/* Returns the slot for name, which is empty if name isn't in the set */
+static const char **glctx_ext_set_find(const GlctxExtSet *set,
+        const char *name)
+{
+    unsigned int n = glctx_hash_name(name) & (set->size - 1);
+
+    while (set->slots[n] && strcmp(set->slots[n], name))
+        n = (n + 1) & (set->size - 1);
+    return &set->slots[n];
+}
+
+/* Builds set from n strings of space-separated names */
+static int glctx_ext_set_build(GlctxExtSet *set,
+        const char **strings, int n)
+{
+    size_t len = 0;
+    unsigned int n_names = 0;
+    char *p;
+    int i;
+
+    for (i = 0; i < n; ++i)
+        len += strlen(strings[i]) + 1;
+    set->names = malloc(len + 1);
+    if (!set->names)
+        return 0;
+    p = set->names;
+    for (i = 0; i < n; ++i)
+    {
+        size_t l = strlen(strings[i]);
+
+        memcpy(p, strings[i], l);
+        p[l] = ' ';
+        p += l + 1;
+    }
+    *p = 0;
+    for (p = set->names; *p; ++p)
+    {
+        if (*p != ' ' && (p == set->names || p[-1] == ' '))
+            ++n_names;
+    }
+
+    /* Keep the load factor under 1/2 */
+    for (set->size = 16; set->size < n_names * 2; set->size *= 2);
+    set->slots = calloc(set->size, sizeof(const char *));
+    if (!set->slots)
+    {
+        glctx_ext_set_free(set);
+        return 0;
+    }
+    for (p = set->names; *p;)
+    {
+        char *name;
+
+        while (*p == ' ')
+            ++p;
+        if (!*p)
+            break;
+        name = p;
+        while (*p && *p != ' ')
+            ++p;
+        if (*p)
+            *p++ = 0;
+        *glctx_ext_set_find(set, name) = name;
+    }
+    set->built = 1;
+    return 1;
+}
+
+static int glctx_ext_set_has(const GlctxExtSet *set, const char *name)
+{
+    return set->size && *glctx_ext_set_find(set, name) != NULL;
+}
+
+/*
+ * Window system extensions are shared by all handles on a display. Entries
+ * are only changed under glctx_display_lock, and lookups don't take it, so
+ * each entry has a generation that's odd while it's forgotten or being
+ * reused: a lookup only accepts an entry whose generation was even and
+ * unchanged while it compared the key. Forgotten entries stay in the list
+ * and are reused for the next display registered, so the list is as long as
+ * the most displays in use at once. glctx__forget_display is only called
+ * once no handle uses the display, so nothing can still be reading the
+ * extensions of an entry being reused.
+ */
+typedef struct GlctxDisplayState_ {
+    void *volatile display;
+    GlctxAtomicInt screen;
+    GlctxAtomicInt gen;
+    GlctxExtSet extensions;
+    struct GlctxDisplayState_ *next;
+} GlctxDisplayState;
+
+static GlctxDisplayState *volatile glctx_display_states = NULL;
+static GlctxMutex glctx_display_lock = GLCTX_MUTEX_INITIALIZER;
+
+static GlctxDisplayState *glctx_find_display_state(void *display, int screen)
+{
+    GlctxDisplayState *state = glctx__atomic_load_ptr(
+            (void *volatile *) &glctx_display_states);
+
+    for (; state; state = state->next)
+    {
+        int gen = glctx__atomic_load_int(&state->gen);
+
+        if (!(gen & 1) &&
+                glctx__atomic_load_ptr(&state->display) == display &&
+                glctx__atomic_load_int(&state->screen) == screen &&
+                glctx__atomic_load_int(&state->gen) == gen)
+        {
+            return state;
+        }
+    }
+    return NULL;
+}
+
+/* Returns a forgotten entry to reuse, must hold glctx_display_lock */
+static GlctxDisplayState *glctx_find_forgotten_display_state(void)
+{
+    GlctxDisplayState *state;
+
+    for (state = glctx_display_states; state; state = state->next)
+    {
+        if (glctx__atomic_load_int(&state->gen) & 1)
+            return state;
+    }
+    return NULL;
+}
+
+/* Returns NULL if the extensions can't be queried yet */
+static GlctxDisplayState *glctx_get_display_state(GlctxHandle ctx)
+{
+    void *display;
+    int screen;
+    GlctxDisplayState *state;
+    GlctxExtSet extensions;
+    const char *strings[4];
+    int n;
+
+    glctx__get_display_key(ctx, &display, &screen);
+    state = glctx_find_display_state(display, screen);
+    if (state)
+        return state;
+
+    glctx__mutex_lock(&glctx_display_lock);
+    state = glctx_find_display_state(display, screen);
+    memset(&extensions, 0, sizeof(extensions));
+    if (!state && (n = glctx__get_native_extensions(ctx, strings, 4)) >= 0 &&
+            glctx_ext_set_build(&extensions, strings, n))
+    {
+        state = glctx_find_forgotten_display_state();
+        if (state)
+        {
+            /* Its generation is already odd */
+            glctx_ext_set_free(&state->extensions);
+            state->extensions = extensions;
+            glctx__atomic_store_ptr(&state->display, display);
+            glctx__atomic_store_int(&state->screen, screen);
+            glctx__atomic_add_int(&state->gen, 1);
+        }
+        else if ((state = calloc(1, sizeof(GlctxDisplayState))) != NULL)
+        {
+            state->extensions = extensions;
+            state->display = display;
+            state->screen = screen;
+            state->next = glctx_display_states;
+            glctx__atomic_store_ptr((void *volatile *) &glctx_display_states,
+                    state);
+        }
+        else
+        {
+            glctx_ext_set_free(&extensions);
+        }
+    }
+    glctx__mutex_unlock(&glctx_display_lock);
+    return state;
+}
+
+void glctx__forget_display(void *display, int screen)
+{
+    GlctxDisplayState *state;
+
+    glctx__mutex_lock(&glctx_display_lock);
+    state = glctx_find_display_state(display, screen);
+    if (state)
+        glctx__atomic_add_int(&state->gen, 1);
+    glctx__mutex_unlock(&glctx_display_lock);
+}
+
+/* The context must be current */
+static void glctx_build_gl_extensions(GlctxHandle ctx, GlctxExtSet *set)
+{
+    GlctxGLProc_GetIntegerv get_integerv = GLCTX_GL(ctx, GetIntegerv);
+    GlctxGLProc_GetStringi get_stringi = GLCTX_GL(ctx, GetStringi);
+    GlctxGLProc_GetString get_string = GLCTX_GL(ctx, GetString);
+    int n_exts = 0;
+
+    /* Core profiles only have glGetStringi(GL_EXTENSIONS) */
+    if (get_integerv && get_stringi)
+        get_integerv(0x821D /* GL_NUM_EXTENSIONS */, &n_exts);
+    if (n_exts > 0)
+    {
+        const char **strings = malloc(sizeof(const char *) * n_exts);
+        int n = 0;
+        int i;
+
+        if (!strings)
+            return;
+        for (i = 0; i < n_exts; ++i)
+        {
+            strings[n] = (const char *)
+                    get_stringi(0x1F03 /* GL_EXTENSIONS */, i);
+            if (strings[n])
+                ++n;
+        }
+        glctx_ext_set_build(set, strings, n);
+        free((void *) strings);
+    }
+    else if (get_string)
+    {
+        const char *exts = (const char *)
+                get_string(0x1F03 /* GL_EXTENSIONS */);
+
+        if (exts)
+            glctx_ext_set_build(set, &exts, 1);
+    }
+    /* Clear any error from glGetIntegerv in older contexts */
+    if (GLCTX_GL(ctx, GetError))
+        GLCTX_GL(ctx, GetError)();
+}
+
+int glctx_has_extension(GlctxHandle ctx, const char *name)
+{
+    GlctxDispatch *dispatch;
+    GlctxDisplayState *state;
+    GlctxExtSet *set;
+
+    if (strncmp(name, "GL_", 3))
+    {
+        state = glctx_get_display_state(ctx);
+        return state && glctx_ext_set_has(&state->extensions, name);
+    }
+    dispatch = glctx_get_dispatch(ctx);
+    if (!dispatch)
+        return 0;
+    set = &dispatch->gl_extensions;
+    if (!set->built && glctx_get_current() == ctx)
+        glctx_build_gl_extensions(ctx, set);
+    return glctx_ext_set_has(set, name);
+}
+
+struct GlctxFenceData_ {
+    void *sync;
+    int native;
+};
+
+void glctx__clear_gl_errors(GlctxHandle ctx)
+{
+    GlctxGLProc_GetError get_error = GLCTX_GL(ctx, GetError);
+    int n;
+
+    if (!get_error)
+        return;
+    /* Bounded because a lost context can report an error on every call */
+    for (n = 0; n < 16; ++n)
+    {
+        if (!get_error())
+            break;
+    }
+}
+
+/* The context must be current */
+int glctx__check_gl_version(GlctxHandle ctx, int gl_major, int gl_minor,
+        int es_major, int es_minor)
+{
+    GlctxGLProc_GetString get_string = GLCTX_GL(ctx, GetString);
+    const char *version = get_string ?
+            (const char *) get_string(0x1F02 /* GL_VERSION */) : NULL;
+    int es = 0, maj = 0, min = 0;
+
+    if (!version)
+        return 0;
+    if (!strncmp(version, "OpenGL ES", 9))
+    {
+        es = 1;
+        version += 9;
+        while (*version && (*version < '0' || *version > '9'))
+            ++version;
+    }
+    if (sscanf(version, "%d.%d", &maj, &min) != 2)
+        return 0;
+    if (es)
+        return maj > es_major || (maj == es_major && min >= es_minor);
+    return maj > gl_major || (maj == gl_major && min >= gl_minor);
+}
+
+static int glctx_has_gl_sync(GlctxHandle ctx)
+{
+    GlctxDispatch *dispatch = glctx_get_dispatch(ctx);
+
+    if (!dispatch)
+        return 0;
+    if (dispatch->gl_sync < 0)
+    {
+        dispatch->gl_sync = glctx_has_extension(ctx, "GL_ARB_sync") ||
+                glctx__check_gl_version(ctx, 3, 2, 3, 0);
+    }
+    return dispatch->gl_sync;
+}
+
+GlctxError glctx_fence_insert(GlctxHandle ctx, GlctxFence *pfence)
+{
+    GlctxFence fence;
+
+    *pfence = NULL;
+    if (glctx_get_current() != ctx)
+        return GLCTX_ERROR_BIND;
+    fence = malloc(sizeof(struct GlctxFenceData_));
+    if (!fence)
+        return GLCTX_ERROR_MEMORY;
+    fence->sync = glctx__native_fence_insert(ctx);
+    fence->native = fence->sync != NULL;
+    if (!fence->native && glctx_has_gl_sync(ctx))
+    {
+        fence->sync = GLCTX_GL(ctx, FenceSync)(
+                0x9117 /* GL_SYNC_GPU_COMMANDS_COMPLETE */, 0);
+    }
+    if (!fence->sync)
+    {
+        glctx__log("glctx: Unable to create a fence\n");
+        free(fence);
+        return GLCTX_ERROR_UNSUPPORTED;
+    }
+    /* Other contexts would wait forever for commands still in our queue */
+    GLCTX_GL(ctx, Flush)();
+    *pfence = fence;
+    return GLCTX_ERROR_NONE;
+}
+
+GlctxError glctx_fence_wait(GlctxHandle ctx, GlctxFence fence,
+        int gpu, long long timeout_ns)
+{
+    unsigned int status;
+
+    if (fence->native)
+        return glctx__native_fence_wait(ctx, fence->sync, gpu, timeout_ns);
+    if (gpu)
+    {
+        GLCTX_GL(ctx, WaitSync)(fence->sync, 0,
+                0xFFFFFFFFFFFFFFFFull /* GL_TIMEOUT_IGNORED */);
+        return GLCTX_ERROR_NONE;
+    }
+    status = GLCTX_GL(ctx, ClientWaitSync)(fence->sync,
+            0x1 /* GL_SYNC_FLUSH_COMMANDS_BIT */,
+            timeout_ns < 0 ? ~0ull : (unsigned long long) timeout_ns);
+    switch (status)
+    {
+        case 0x911A:    /* GL_ALREADY_SIGNALED */
+        case 0x911C:    /* GL_CONDITION_SATISFIED */
+            return GLCTX_ERROR_NONE;
+        case 0x911B:    /* GL_TIMEOUT_EXPIRED */
+            return GLCTX_ERROR_TIMEOUT;
+        default:
+            glctx__log("glctx: glClientWaitSync failed\n");
+            return GLCTX_ERROR_CONTEXT;
+    }
+}
+
+int glctx_fence_poll(GlctxHandle ctx, GlctxFence fence)
+{
+    return glctx_fence_wait(ctx, fence, 0, 0) != GLCTX_ERROR_TIMEOUT;
+}
+
+void glctx_fence_destroy(GlctxHandle ctx, GlctxFence fence)
+{
+    if (!fence)
+        return;
+    if (fence->native)
+        glctx__native_fence_destroy(ctx, fence->sync);
+    else
+        GLCTX_GL(ctx, DeleteSync)(fence->sync);
+    free(fence);
+}
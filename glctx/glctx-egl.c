@@ -1,7 +1,9 @@
-#include "glctx.h"
+#include "glctx-private.h"
 
 #include "EGL/egl.h"
+#include "EGL/eglext.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 
 #ifdef __ANDROID__
@@ -11,10 +13,79 @@
 extern int glGetError(void);
 #endif
 
-extern int (*glctx__log)(const char *format, ...);
-extern int glctx__log_ignore(const char *format, ...);
-extern int *glctx__make_attrs_buffer(const int *attrs,
-        const int *native_attrs, int native_attr_term);
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+#ifndef EGL_PLATFORM_X11_EXT
+#define EGL_PLATFORM_X11_EXT 0x31D5
+#endif
+#ifndef EGL_PLATFORM_WAYLAND_EXT
+#define EGL_PLATFORM_WAYLAND_EXT 0x31D8
+#endif
+#ifndef EGL_PLATFORM_GBM_MESA
+#define EGL_PLATFORM_GBM_MESA 0x31D7
+#endif
+#ifndef EGL_CONTEXT_FLAGS_KHR
+#define EGL_CONTEXT_FLAGS_KHR 0x30FC
+#define EGL_CONTEXT_OPENGL_DEBUG_BIT_KHR 0x0001
+#define EGL_CONTEXT_OPENGL_ROBUST_ACCESS_BIT_KHR 0x0004
+#define EGL_CONTEXT_OPENGL_RESET_NOTIFICATION_STRATEGY_KHR 0x31BD
+#define EGL_LOSE_CONTEXT_ON_RESET_KHR 0x31BF
+#endif
+#ifndef EGL_CONTEXT_OPENGL_ROBUST_ACCESS_EXT
+#define EGL_CONTEXT_OPENGL_ROBUST_ACCESS_EXT 0x30BF
+#define EGL_CONTEXT_OPENGL_RESET_NOTIFICATION_STRATEGY_EXT 0x3138
+#define EGL_LOSE_CONTEXT_ON_RESET_EXT 0x31BF
+#endif
+#ifndef EGL_CONTEXT_OPENGL_NO_ERROR_KHR
+#define EGL_CONTEXT_OPENGL_NO_ERROR_KHR 0x31B3
+#endif
+#ifndef EGL_CONTEXT_RELEASE_BEHAVIOR_KHR
+#define EGL_CONTEXT_RELEASE_BEHAVIOR_KHR 0x2097
+#define EGL_CONTEXT_RELEASE_BEHAVIOR_NONE_KHR 0
+#endif
+
+#ifndef EGL_SYNC_FENCE_KHR
+#define EGL_SYNC_FENCE_KHR 0x30F9
+#define EGL_SYNC_FLUSH_COMMANDS_BIT_KHR 0x0001
+#define EGL_TIMEOUT_EXPIRED_KHR 0x30F5
+#define EGL_CONDITION_SATISFIED_KHR 0x30F6
+#endif
+#ifndef EGL_BUFFER_AGE_EXT
+#define EGL_BUFFER_AGE_EXT 0x313D
+#endif
+#ifndef EGL_PLATFORM_DEVICE_EXT
+#define EGL_PLATFORM_DEVICE_EXT 0x313F
+#endif
+#ifndef EGL_DRM_DEVICE_FILE_EXT
+#define EGL_DRM_DEVICE_FILE_EXT 0x3233
+#endif
+#ifndef EGL_DRM_RENDER_NODE_FILE_EXT
+#define EGL_DRM_RENDER_NODE_FILE_EXT 0x3377
+#endif
+#ifndef EGL_DEVICE_EXT
+#define EGL_DEVICE_EXT 0x322C
+#endif
+
+typedef EGLDisplay (EGLAPIENTRY *eglGetPlatformDisplayEXTProc)
+        (EGLenum, void *, const EGLint *);
+typedef EGLBoolean (EGLAPIENTRY *eglSwapBuffersWithDamageProc)
+        (EGLDisplay, EGLSurface, const EGLint *, EGLint);
+typedef EGLBoolean (EGLAPIENTRY *eglSetDamageRegionKHRProc)
+        (EGLDisplay, EGLSurface, EGLint *, EGLint);
+typedef void *(EGLAPIENTRY *eglCreateSyncKHRProc)
+        (EGLDisplay, EGLenum, const EGLint *);
+typedef EGLBoolean (EGLAPIENTRY *eglDestroySyncKHRProc)(EGLDisplay, void *);
+typedef EGLint (EGLAPIENTRY *eglClientWaitSyncKHRProc)
+        (EGLDisplay, void *, EGLint, unsigned long long);
+typedef EGLint (EGLAPIENTRY *eglWaitSyncKHRProc)(EGLDisplay, void *, EGLint);
+typedef EGLBoolean (EGLAPIENTRY *eglQueryDevicesEXTProc)
+        (EGLint, void **, EGLint *);
+typedef const char *(EGLAPIENTRY *eglQueryDeviceStringEXTProc)
+        (void *, EGLint);
+typedef EGLBoolean (EGLAPIENTRY *eglQueryDisplayAttribEXTProc)
+        (EGLDisplay, EGLint, EGLAttrib *);
+typedef const char *(EGLAPIENTRY *eglGetDisplayDriverNameProc)(EGLDisplay);
 
 static int glctx__attr_table[] = {
     EGL_NONE,
@@ -26,52 +97,402 @@ static int glctx__attr_table[] = {
     EGL_STENCIL_SIZE
 };
 
+struct GlctxSurfaceData_ {
+    EGLSurface surface;
+    GlctxSizeCache size;
+    struct GlctxSurfaceData_ *next;
+};
+
 struct GlctxData_ {
     EGLDisplay display;
+    EGLenum platform;       /* 0 if from eglGetDisplay */
     EGLSurface surface;
+    GlctxSizeCache size;
+    GlctxSurface surfaces;
+    GlctxSurface draw, read;
     EGLContext context;
+    EGLConfig config;
     GlctxWindow window;
     GlctxProfile profile;
     int version;
+    int headless;
+    int width, height;
+    int flags;
+    GlctxDispatch *dispatch;
 #if GLCTX_ENABLE_RPI
     EGL_DISPMANX_WINDOW_T nativewindow;
 #endif
 };
 
-GlctxError glctx_init(GlctxDisplay display, GlctxWindow window,
-                      GlctxProfile profile, int maj_version, int min_version,
-                      GlctxHandle *pctx)
+/*
+ * EGL displays are shared by every handle on the same native display, so
+ * they're reference counted: the first handle initialises the display and
+ * the last one terminates it.
+ */
+typedef struct GlctxDisplayRef_ {
+    EGLDisplay display;
+    int refs;
+    struct GlctxDisplayRef_ *next;
+} GlctxDisplayRef;
+
+static GlctxDisplayRef *glctx_display_refs = NULL;
+static GlctxMutex glctx_display_refs_lock = GLCTX_MUTEX_INITIALIZER;
+
+static GlctxError glctx_acquire_display(EGLDisplay edpy)
 {
-    GlctxHandle ctx = malloc(sizeof(struct GlctxData_));
+    GlctxDisplayRef *ref;
+    GlctxError result = GLCTX_ERROR_NONE;
     EGLint emaj, emin;
 
+    glctx__mutex_lock(&glctx_display_refs_lock);
+    for (ref = glctx_display_refs; ref; ref = ref->next)
+    {
+        if (ref->display == edpy)
+            break;
+    }
+    if (ref)
+    {
+        ++ref->refs;
+    }
+    else if (!(ref = malloc(sizeof(GlctxDisplayRef))))
+    {
+        result = GLCTX_ERROR_MEMORY;
+    }
+    else if (!eglInitialize(edpy, &emaj, &emin))
+    {
+        free(ref);
+        result = GLCTX_ERROR_DISPLAY;
+    }
+    else
+    {
+        glctx__log("glctx: Initialised display with EGL %d.%d\n", emaj, emin);
+        ref->display = edpy;
+        ref->refs = 1;
+        ref->next = glctx_display_refs;
+        glctx_display_refs = ref;
+    }
+    glctx__mutex_unlock(&glctx_display_refs_lock);
+    return result;
+}
+
+static void glctx_release_display(EGLDisplay edpy)
+{
+    GlctxDisplayRef **pref;
+    GlctxDisplayRef *ref;
+
+    glctx__mutex_lock(&glctx_display_refs_lock);
+    for (pref = &glctx_display_refs; (ref = *pref) != NULL; pref = &ref->next)
+    {
+        if (ref->display == edpy)
+        {
+            if (!--ref->refs)
+            {
+                *pref = ref->next;
+                eglTerminate(edpy);
+                free(ref);
+                glctx__log("glctx: Terminated display\n");
+            }
+            break;
+        }
+    }
+    glctx__mutex_unlock(&glctx_display_refs_lock);
+}
+
+static GlctxError glctx_init_egl_display(EGLDisplay edpy, EGLenum platform,
+        GlctxWindow window, GlctxProfile profile, int maj_version,
+        GlctxHandle *pctx)
+{
+    GlctxHandle ctx;
+    GlctxError result;
+
     *pctx = NULL;
+    if (edpy == EGL_NO_DISPLAY)
+        return GLCTX_ERROR_DISPLAY;
+    ctx = malloc(sizeof(struct GlctxData_));
     if (!ctx)
         return GLCTX_ERROR_MEMORY;
-#if GLCTX_ENABLE_RPI
-    (void) display;
-    ctx->display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
-#else
-    ctx->display = eglGetDisplay(display);
-#endif
-    ctx->surface = EGL_NO_SURFACE;
-    ctx->context = EGL_NO_CONTEXT;
-    if (ctx->display == EGL_NO_DISPLAY ||
-            !eglInitialize(ctx->display, &emaj, &emin))
+    result = glctx_acquire_display(edpy);
+    if (result)
     {
         free(ctx);
-        return GLCTX_ERROR_DISPLAY;
+        return result;
     }
+    ctx->display = edpy;
+    ctx->platform = platform;
+    ctx->surface = EGL_NO_SURFACE;
+    glctx__set_size(&ctx->size, 0, 0);
+    ctx->surfaces = ctx->draw = ctx->read = NULL;
+    ctx->context = EGL_NO_CONTEXT;
     *pctx = ctx;
     ctx->window = window;
     ctx->profile = profile;
     ctx->version = maj_version;
+    ctx->headless = 0;
+    ctx->width = ctx->height = 0;
+    ctx->flags = 0;
+    ctx->dispatch = NULL;
+    return GLCTX_ERROR_NONE;
+}
+
+static GlctxError glctx_init_headless_display(EGLDisplay edpy,
+        EGLenum platform, GlctxProfile profile, int maj_version,
+        int width, int height, GlctxHandle *pctx)
+{
+    GlctxError result = glctx_init_egl_display(edpy, platform, 0, profile,
+            maj_version, pctx);
+
+    if (result)
+        return result;
+    (*pctx)->headless = 1;
+    (*pctx)->width = width > 0 ? width : 1;
+    (*pctx)->height = height > 0 ? height : 1;
+    return GLCTX_ERROR_NONE;
+}
+
+GlctxError glctx_init(GlctxDisplay display, GlctxWindow window,
+                      GlctxProfile profile, int maj_version, int min_version,
+                      GlctxHandle *pctx)
+{
+    (void) min_version;
+#if GLCTX_ENABLE_RPI
+    (void) display;
+    return glctx_init_egl_display(eglGetDisplay(EGL_DEFAULT_DISPLAY), 0,
+            window, profile, maj_version, pctx);
+#else
+    return glctx_init_egl_display(eglGetDisplay(display), 0,
+            window, profile, maj_version, pctx);
+#endif
+}
+
+/* Indexed by GlctxPlatform; either client extension will do */
+static const struct {
+    EGLenum platform;
+    const char *ext, *alt_ext;
+    const char *name;
+} glctx_platforms[] = {
+    { 0, NULL, NULL, "default" },
+    { EGL_PLATFORM_X11_EXT, "EGL_EXT_platform_x11",
+            "EGL_KHR_platform_x11", "X11" },
+    { EGL_PLATFORM_WAYLAND_EXT, "EGL_EXT_platform_wayland",
+            "EGL_KHR_platform_wayland", "Wayland" },
+    { EGL_PLATFORM_GBM_MESA, "EGL_MESA_platform_gbm",
+            "EGL_KHR_platform_gbm", "GBM" },
+    { EGL_PLATFORM_SURFACELESS_MESA, "EGL_MESA_platform_surfaceless",
+            NULL, "surfaceless" }
+};
+
+/* Returns EGL_NO_DISPLAY without probing others if platform isn't there */
+static EGLDisplay glctx_get_platform_display(GlctxPlatform platform,
+        void *display)
+{
+    const char *exts = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    eglGetPlatformDisplayEXTProc get_platform_display;
+    EGLDisplay edpy;
+
+    if ((unsigned int) platform >=
+            sizeof(glctx_platforms) / sizeof(glctx_platforms[0]))
+    {
+        return EGL_NO_DISPLAY;
+    }
+    if (platform == GLCTX_PLATFORM_DEFAULT)
+        return eglGetDisplay((EGLNativeDisplayType) display);
+    if (!glctx__supports_extension(exts, glctx_platforms[platform].ext) &&
+            (!glctx_platforms[platform].alt_ext ||
+            !glctx__supports_extension(exts,
+                    glctx_platforms[platform].alt_ext)))
+    {
+        glctx__log("glctx: EGL %s platform not supported\n",
+                glctx_platforms[platform].name);
+        return EGL_NO_DISPLAY;
+    }
+    get_platform_display = (eglGetPlatformDisplayEXTProc)
+            eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (!get_platform_display)
+        return EGL_NO_DISPLAY;
+    edpy = get_platform_display(glctx_platforms[platform].platform,
+            display, NULL);
+    if (edpy != EGL_NO_DISPLAY)
+    {
+        glctx__log("glctx: Using EGL %s platform\n",
+                glctx_platforms[platform].name);
+    }
+    return edpy;
+}
+
+GlctxError glctx_init_platform(GlctxPlatform platform,
+        void *display, GlctxWindow window,
+        GlctxProfile profile, int maj_version, int min_version,
+        GlctxHandle *pctx)
+{
+    EGLDisplay edpy = glctx_get_platform_display(platform, display);
+
+    (void) min_version;
+    *pctx = NULL;
+    if (edpy == EGL_NO_DISPLAY)
+    {
+        return platform == GLCTX_PLATFORM_DEFAULT ?
+                GLCTX_ERROR_DISPLAY : GLCTX_ERROR_UNSUPPORTED;
+    }
+    if (platform == GLCTX_PLATFORM_SURFACELESS)
+    {
+        return glctx_init_headless_display(edpy,
+                EGL_PLATFORM_SURFACELESS_MESA, profile, maj_version,
+                1, 1, pctx);
+    }
+    return glctx_init_egl_display(edpy, glctx_platforms[platform].platform,
+            window, profile, maj_version, pctx);
+}
+
+GlctxError glctx_init_headless(GlctxProfile profile,
+        int maj_version, int min_version, int width, int height,
+        GlctxHandle *pctx)
+{
+    EGLDisplay edpy = EGL_NO_DISPLAY;
+    EGLenum platform = EGL_PLATFORM_SURFACELESS_MESA;
+
     (void) min_version;
-    glctx__log("glctx: Initialised display with EGL %d.%d\n", emaj, emin);
+#if !GLCTX_ENABLE_RPI && !defined(__ANDROID__)
+    edpy = glctx_get_platform_display(GLCTX_PLATFORM_SURFACELESS, NULL);
+#endif
+    if (edpy == EGL_NO_DISPLAY)
+    {
+        edpy = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        platform = 0;
+    }
+    return glctx_init_headless_display(edpy, platform, profile, maj_version,
+            width, height, pctx);
+}
+
+/* Returns the number of devices, with an array in *pdevices to be freed */
+static int glctx_query_devices(void ***pdevices)
+{
+    eglQueryDevicesEXTProc query_devices;
+    EGLint count = 0;
+
+    *pdevices = NULL;
+    if (!glctx__supports_extension(
+            eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS),
+            "EGL_EXT_device_enumeration"))
+    {
+        glctx__log("glctx: EGL_EXT_device_enumeration not supported\n");
+        return 0;
+    }
+    query_devices = (eglQueryDevicesEXTProc)
+            eglGetProcAddress("eglQueryDevicesEXT");
+    if (!query_devices || !query_devices(0, NULL, &count) || count < 1)
+        return 0;
+    *pdevices = malloc(sizeof(void *) * count);
+    if (!*pdevices)
+        return 0;
+    if (!query_devices(count, *pdevices, &count) || count < 1)
+    {
+        free(*pdevices);
+        *pdevices = NULL;
+        return 0;
+    }
+    return count;
+}
+
+static void glctx_copy_device_string(char *buf, size_t size,
+        eglQueryDeviceStringEXTProc query_string, void *device, EGLint name)
+{
+    const char *value = query_string ? query_string(device, name) : NULL;
+
+    /* Fails with EGL_BAD_PARAMETER if the device doesn't have the string */
+    snprintf(buf, size, "%s", value ? value : "");
+}
+
+GlctxError glctx_enumerate_devices(GlctxDeviceInfo **pinfos, int *pcount)
+{
+    eglQueryDeviceStringEXTProc query_string = (eglQueryDeviceStringEXTProc)
+            eglGetProcAddress("eglQueryDeviceStringEXT");
+    void **devices;
+    GlctxDeviceInfo *infos;
+    int count = glctx_query_devices(&devices);
+    int n;
+
+    *pinfos = NULL;
+    *pcount = 0;
+    if (!count)
+        return GLCTX_ERROR_UNSUPPORTED;
+    infos = calloc(count, sizeof(GlctxDeviceInfo));
+    if (!infos)
+    {
+        free(devices);
+        return GLCTX_ERROR_MEMORY;
+    }
+    for (n = 0; n < count; ++n)
+    {
+        GlctxDeviceInfo *info = &infos[n];
+        const char *exts = query_string ?
+                query_string(devices[n], EGL_EXTENSIONS) : NULL;
+
+        info->index = n;
+        info->software = glctx__supports_extension(exts,
+                "EGL_MESA_device_software");
+        if (glctx__supports_extension(exts, "EGL_EXT_device_drm"))
+        {
+            glctx_copy_device_string(info->drm_file, sizeof(info->drm_file),
+                    query_string, devices[n], EGL_DRM_DEVICE_FILE_EXT);
+        }
+        if (glctx__supports_extension(exts,
+                "EGL_EXT_device_drm_render_node"))
+        {
+            glctx_copy_device_string(info->render_node,
+                    sizeof(info->render_node), query_string, devices[n],
+                    EGL_DRM_RENDER_NODE_FILE_EXT);
+        }
+    }
+    free(devices);
+    *pinfos = infos;
+    *pcount = count;
     return GLCTX_ERROR_NONE;
 }
 
-GlctxError glctx_get_config(GlctxHandle ctx, GlctxConfig *cfg_out,
+void glctx_free_devices(GlctxDeviceInfo *infos)
+{
+    free(infos);
+}
+
+GlctxError glctx_init_device(int index, GlctxProfile profile,
+        int maj_version, int min_version, int width, int height,
+        GlctxHandle *pctx)
+{
+    eglGetPlatformDisplayEXTProc get_platform_display;
+    EGLDisplay edpy = EGL_NO_DISPLAY;
+    void **devices;
+    int count = glctx_query_devices(&devices);
+
+    (void) min_version;
+    *pctx = NULL;
+    if (index < 0 || index >= count)
+    {
+        glctx__log("glctx: No EGL device %d\n", index);
+        free(devices);
+        return GLCTX_ERROR_DISPLAY;
+    }
+    get_platform_display = (eglGetPlatformDisplayEXTProc)
+            eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (get_platform_display && glctx__supports_extension(
+            eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS),
+            "EGL_EXT_platform_device"))
+    {
+        edpy = get_platform_display(EGL_PLATFORM_DEVICE_EXT,
+                devices[index], NULL);
+    }
+    free(devices);
+    if (edpy == EGL_NO_DISPLAY)
+    {
+        glctx__log("glctx: Unable to get display for EGL device %d\n", index);
+        return GLCTX_ERROR_DISPLAY;
+    }
+    glctx__log("glctx: Using EGL device %d\n", index);
+    return glctx_init_headless_display(edpy, EGL_PLATFORM_DEVICE_EXT,
+            profile, maj_version, width, height, pctx);
+}
+
+/* Returns a buffer which must be freed if it isn't attrs */
+static EGLint *glctx_make_config_attrs(GlctxHandle ctx,
         const int *attrs, int native_attrs)
 {
     int eprofile = (ctx->profile == GLCTX_PROFILE_OPENGLES) ?
@@ -80,103 +501,199 @@ GlctxError glctx_get_config(GlctxHandle ctx, GlctxConfig *cfg_out,
     EGLint default_attrs[] = {
         EGL_RENDERABLE_TYPE, eprofile,
         EGL_CONFORMANT, eprofile,
+        EGL_SURFACE_TYPE, ctx->headless ? EGL_PBUFFER_BIT : EGL_WINDOW_BIT,
         EGL_NONE
     };
-    EGLint n_configs = 0;
     int *all_attrs;
     int i = 0;
     int n;
 
-    if (native_attrs)
+    if (native_attrs && attrs)
+        return (EGLint *) attrs;
+    all_attrs = glctx__make_attrs_buffer(native_attrs ? NULL : attrs,
+            default_attrs, EGL_NONE);
+    if (!all_attrs)
+        return NULL;
+    if (attrs && !native_attrs)
     {
-        all_attrs = (int *) default_attrs;
-    }
-    else
-    {
-        all_attrs = glctx__make_attrs_buffer(attrs, default_attrs, EGL_NONE);
-        i = 0;
-        if (attrs)
+        for (n = 0; attrs[n]; n += 2)
         {
-            for (n = 0; attrs[n]; n += 2)
-            {
-                all_attrs[i++] = glctx__attr_table[attrs[n]];
-                all_attrs[i++] = attrs[n + 1];
-            }
+            all_attrs[i++] = glctx__attr_table[attrs[n]];
+            all_attrs[i++] = attrs[n + 1];
         }
-        for (n = 0; default_attrs[n] != EGL_NONE; n += 2)
-        {
-            all_attrs[i++] = default_attrs[n];
-            all_attrs[i++] = default_attrs[n + 1];
-        }
-        all_attrs[i] = EGL_NONE;
     }
-
-    if (glctx__log != glctx__log_ignore)
+    for (n = 0; default_attrs[n] != EGL_NONE; n += 2)
     {
-        int n;
-        int chosen = 0;
-        int result = eglChooseConfig(ctx->display, all_attrs, 0, 0, &n_configs);
+        all_attrs[i++] = default_attrs[n];
+        all_attrs[i++] = default_attrs[n + 1];
+    }
+    all_attrs[i] = EGL_NONE;
+    return all_attrs;
+}
 
-        if (!result || n_configs < 1)
-        {
-            free(all_attrs);
-            glctx__log("glctx: No EGL configs available:\n");
-            return GLCTX_ERROR_CONFIG;
-        }
-        glctx__log("glctx: %d EGL configs available:\n", n_configs);
-        EGLConfig *configs = malloc(sizeof(EGLConfig) * n_configs);
-        eglChooseConfig(ctx->display, all_attrs,
-                configs, n_configs, &n_configs);
-        if (!native_attrs)
-            free(all_attrs);
-
-        for (n = 0; n < n_configs; ++n)
-        {
-            EGLint r, g, b, a, d;
+GlctxError glctx_get_config(GlctxHandle ctx, GlctxConfig *cfg_out,
+        const int *attrs, int native_attrs)
+{
+    return glctx_choose_config(ctx, cfg_out, attrs, native_attrs, 0, NULL);
+}
 
-            if (!configs[n])
-            {
-                glctx__log("  Config %d is NULL!\n", n);
-                if (n == chosen)
-                    ++chosen;
-                continue;
-            }
-            eglGetConfigAttrib(ctx->display, configs[n], EGL_RED_SIZE, &r);
-            eglGetConfigAttrib(ctx->display, configs[n], EGL_GREEN_SIZE, &g);
-            eglGetConfigAttrib(ctx->display, configs[n], EGL_BLUE_SIZE, &b);
-            eglGetConfigAttrib(ctx->display, configs[n], EGL_ALPHA_SIZE, &a);
-            eglGetConfigAttrib(ctx->display, configs[n], EGL_DEPTH_SIZE, &d);
-            glctx__log("  %d, RGBA(%d%d%d%d), depth %d\n",
-                    n, r, g, b, a, d);
-        }
-        if (chosen >= n_configs)
+int glctx_query_config(GlctxHandle ctx, GlctxConfig config, GlctxAttr attr)
+{
+    EGLint val;
+
+    eglGetConfigAttrib(ctx->display, config, glctx__attr_table[attr], &val);
+    return val;
+}
+
+static int glctx_get_config_attrib(GlctxHandle ctx, EGLConfig config,
+        EGLint attr)
+{
+    EGLint val = 0;
+
+    eglGetConfigAttrib(ctx->display, config, attr, &val);
+    return val;
+}
+
+void glctx__get_config_info(GlctxHandle ctx, GlctxConfig config,
+        GlctxConfigInfo *info)
+{
+    info->config = config;
+    info->id = glctx_get_config_attrib(ctx, config, EGL_CONFIG_ID);
+    info->red_size = glctx_get_config_attrib(ctx, config, EGL_RED_SIZE);
+    info->green_size = glctx_get_config_attrib(ctx, config, EGL_GREEN_SIZE);
+    info->blue_size = glctx_get_config_attrib(ctx, config, EGL_BLUE_SIZE);
+    info->alpha_size = glctx_get_config_attrib(ctx, config, EGL_ALPHA_SIZE);
+    info->depth_size = glctx_get_config_attrib(ctx, config, EGL_DEPTH_SIZE);
+    info->stencil_size = glctx_get_config_attrib(ctx, config,
+            EGL_STENCIL_SIZE);
+    info->samples = glctx_get_config_attrib(ctx, config, EGL_SAMPLES);
+    /* In EGL sRGB is chosen per surface, so any 8-bit config will do */
+    info->srgb = info->red_size == 8 &&
+            glctx_has_extension(ctx, "EGL_KHR_gl_colorspace");
+    /* EGL window surfaces are always back-buffered */
+    info->double_buffer = 1;
+}
+
+GlctxError glctx_enumerate_configs(GlctxHandle ctx,
+        const int *attrs, int native_attrs,
+        GlctxConfigInfo **pinfos, int *pcount)
+{
+    EGLint *all_attrs = glctx_make_config_attrs(ctx, attrs, native_attrs);
+    EGLint n_configs = 0;
+    EGLConfig *configs = NULL;
+    GlctxConfigInfo *infos = NULL;
+    int n;
+
+    *pinfos = NULL;
+    *pcount = 0;
+    if (!all_attrs)
+        return GLCTX_ERROR_MEMORY;
+    if (eglChooseConfig(ctx->display, all_attrs, NULL, 0, &n_configs) &&
+            n_configs > 0)
+    {
+        configs = malloc(sizeof(EGLConfig) * n_configs);
+        infos = malloc(sizeof(GlctxConfigInfo) * n_configs);
+        if (configs && infos)
         {
-            glctx__log("glctx: No EGL configs available:\n");
-            free(configs);
-            return GLCTX_ERROR_CONFIG;
+            eglChooseConfig(ctx->display, all_attrs,
+                    configs, n_configs, &n_configs);
         }
-        *cfg_out = configs[chosen];
+    }
+    if (all_attrs != attrs)
+        free(all_attrs);
+    if (!configs || !infos)
+    {
         free(configs);
+        free(infos);
+        return n_configs > 0 ? GLCTX_ERROR_MEMORY : GLCTX_ERROR_CONFIG;
     }
-    else
+
+    for (n = 0; n < n_configs; ++n)
+        glctx__get_config_info(ctx, configs[n], &infos[n]);
+    free(configs);
+    *pinfos = infos;
+    *pcount = n_configs;
+    return GLCTX_ERROR_NONE;
+}
+
+GlctxError glctx_get_config_by_id(GlctxHandle ctx, int id,
+        GlctxConfig *cfg_out)
+{
+    EGLint attrs[] = {
+        EGL_CONFIG_ID, id,
+        EGL_NONE
+    };
+    EGLint n_configs = 0;
+
+    if (!eglChooseConfig(ctx->display, attrs, cfg_out, 1, &n_configs) ||
+            n_configs < 1)
     {
-        int result = eglChooseConfig(ctx->display, all_attrs,
-                cfg_out, 1, &n_configs);
-        free(all_attrs);
-        if (!result || n_configs < 1)
-        {
-            return GLCTX_ERROR_CONFIG;
-        }
+        return GLCTX_ERROR_CONFIG;
     }
     return GLCTX_ERROR_NONE;
 }
 
-int glctx_query_config(GlctxHandle ctx, GlctxConfig config, GlctxAttr attr)
+/* The DRM node identifies the GPU; software devices don't have one */
+static void glctx_describe_device(GlctxHandle ctx, char *buf, size_t size)
 {
-    EGLint val;
+    eglQueryDisplayAttribEXTProc query_display_attrib =
+            (eglQueryDisplayAttribEXTProc)
+            eglGetProcAddress("eglQueryDisplayAttribEXT");
+    eglQueryDeviceStringEXTProc query_string = (eglQueryDeviceStringEXTProc)
+            eglGetProcAddress("eglQueryDeviceStringEXT");
+    EGLAttrib device = 0;
+    const char *exts;
+    char node[256];
 
-    eglGetConfigAttrib(ctx->display, config, glctx__attr_table[attr], &val);
-    return val;
+    buf[0] = 0;
+    if (!query_display_attrib || !query_string || !glctx__supports_extension(
+            eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS),
+            "EGL_EXT_device_query") ||
+            !query_display_attrib(ctx->display, EGL_DEVICE_EXT, &device) ||
+            !device)
+    {
+        return;
+    }
+    exts = query_string((void *) device, EGL_EXTENSIONS);
+    node[0] = 0;
+    if (glctx__supports_extension(exts, "EGL_EXT_device_drm_render_node"))
+    {
+        glctx_copy_device_string(node, sizeof(node), query_string,
+                (void *) device, EGL_DRM_RENDER_NODE_FILE_EXT);
+    }
+    if (!node[0] && glctx__supports_extension(exts, "EGL_EXT_device_drm"))
+    {
+        glctx_copy_device_string(node, sizeof(node), query_string,
+                (void *) device, EGL_DRM_DEVICE_FILE_EXT);
+    }
+    snprintf(buf, size, "%s|%s", node, exts ? exts : "");
+}
+
+void glctx__describe_driver(GlctxHandle ctx, char *buf, size_t size)
+{
+    const char *vendor = eglQueryString(ctx->display, EGL_VENDOR);
+    const char *version = eglQueryString(ctx->display, EGL_VERSION);
+    const char *apis = eglQueryString(ctx->display, EGL_CLIENT_APIS);
+    const char *driver = NULL;
+    char device[768];
+    EGLint n_configs = 0;
+
+    if (glctx_has_extension(ctx, "EGL_MESA_query_driver"))
+    {
+        eglGetDisplayDriverNameProc get_driver_name =
+                (eglGetDisplayDriverNameProc)
+                eglGetProcAddress("eglGetDisplayDriverName");
+
+        if (get_driver_name)
+            driver = get_driver_name(ctx->display);
+    }
+    glctx_describe_device(ctx, device, sizeof(device));
+    /* A driver update usually changes the set of configs too */
+    eglGetConfigs(ctx->display, NULL, 0, &n_configs);
+    snprintf(buf, size, "EGL|%s|%s|%s|%s|%#x|%s|%d|%d|%d|%d",
+            vendor ? vendor : "", version ? version : "",
+            apis ? apis : "", driver ? driver : "", ctx->platform,
+            device, n_configs, ctx->profile, ctx->version, ctx->headless);
 }
 
 #if defined(__ANDROID__)
@@ -242,27 +759,31 @@ static GlctxError glctx_configure_platform(GlctxHandle ctx, GlctxConfig config)
 }
 #endif
 
-GlctxError glctx_activate(GlctxHandle ctx, GlctxConfig config,
-        GlctxWindow window, const int *attrs)
+/*
+ * The bound API is per thread and eglMakeCurrent only affects the context
+ * for that API, so call this on each thread before binding or unbinding
+ */
+static int glctx_bind_api(GlctxHandle ctx)
 {
-    EGLenum eapi;
-    EGLint default_attrs[] = {
-            EGL_CONTEXT_CLIENT_VERSION, ctx->version,
-            EGL_NONE
-    };
-    GlctxError result = GLCTX_ERROR_NONE;
+    return eglBindAPI((ctx->profile == GLCTX_PROFILE_OPENGLES) ?
+            EGL_OPENGL_ES_API : EGL_OPENGL_API);
+}
 
-    ctx->window = window;
-    if (!attrs)
-        attrs = default_attrs;
-    if (ctx->profile == GLCTX_PROFILE_OPENGLES)
-        eapi = EGL_OPENGL_ES_API;
-    else
-        eapi = EGL_OPENGL_API;
-    if (!eglBindAPI(eapi))
-        return GLCTX_ERROR_PROFILE;
+static void glctx_init_size(GlctxHandle ctx, EGLSurface surface,
+        GlctxSizeCache *size)
+{
+    EGLint width = 0, height = 0;
+
+    eglQuerySurface(ctx->display, surface, EGL_WIDTH, &width);
+    eglQuerySurface(ctx->display, surface, EGL_HEIGHT, &height);
+    glctx__set_size(size, width, height);
+}
+
+static GlctxError glctx_create_window_surface(GlctxHandle ctx,
+        GlctxConfig config)
+{
+    GlctxError result = glctx_configure_platform(ctx, config);
 
-    result = glctx_configure_platform(ctx, config);
     if (result)
         return result;
 
@@ -270,7 +791,7 @@ GlctxError glctx_activate(GlctxHandle ctx, GlctxConfig config,
 #if GLCTX_ENABLE_RPI
             &ctx->nativewindow,
 #else
-            window,
+            ctx->window,
 #endif
             0);
     if (ctx->surface == EGL_NO_SURFACE)
@@ -278,6 +799,131 @@ GlctxError glctx_activate(GlctxHandle ctx, GlctxConfig config,
         glctx__log("glctx: Unable to create OpenGL(ES) surface with EGL\n");
         return GLCTX_ERROR_SURFACE;
     }
+    glctx_init_size(ctx, ctx->surface, &ctx->size);
+    return GLCTX_ERROR_NONE;
+}
+
+/* Leaves surface as EGL_NO_SURFACE if the display supports surfaceless
+ * contexts, otherwise falls back to a pbuffer.
+ */
+static GlctxError glctx_create_headless_surface(GlctxHandle ctx,
+        GlctxConfig config)
+{
+    EGLint pb_attrs[] = {
+        EGL_WIDTH, ctx->width,
+        EGL_HEIGHT, ctx->height,
+        EGL_NONE
+    };
+
+    glctx__set_size(&ctx->size, ctx->width, ctx->height);
+    if (glctx_has_extension(ctx, "EGL_KHR_surfaceless_context"))
+    {
+        glctx__log("glctx: Using surfaceless EGL context\n");
+        ctx->surface = EGL_NO_SURFACE;
+        return GLCTX_ERROR_NONE;
+    }
+    ctx->surface = eglCreatePbufferSurface(ctx->display, config, pb_attrs);
+    if (ctx->surface == EGL_NO_SURFACE)
+    {
+        glctx__log("glctx: Unable to create EGL pbuffer surface\n");
+        return GLCTX_ERROR_SURFACE;
+    }
+    return GLCTX_ERROR_NONE;
+}
+
+void glctx_set_context_flags(GlctxHandle ctx, int flags)
+{
+    ctx->flags = glctx__check_context_flags(flags);
+}
+
+/* attrs must have room for 13 values */
+static void glctx_make_context_attrs(GlctxHandle ctx, EGLint *attrs)
+{
+    int create_context = glctx_has_extension(ctx, "EGL_KHR_create_context");
+    EGLint flag_bits = 0;
+    int n = 0;
+
+    attrs[n++] = EGL_CONTEXT_CLIENT_VERSION;
+    attrs[n++] = ctx->version;
+    if ((ctx->flags & GLCTX_CONTEXT_DEBUG) && create_context)
+        flag_bits |= EGL_CONTEXT_OPENGL_DEBUG_BIT_KHR;
+    else if (ctx->flags & GLCTX_CONTEXT_DEBUG)
+        glctx__log("glctx: Debug contexts not supported\n");
+    if (ctx->flags & GLCTX_CONTEXT_ROBUST)
+    {
+        if (ctx->profile != GLCTX_PROFILE_OPENGLES && create_context)
+        {
+            flag_bits |= EGL_CONTEXT_OPENGL_ROBUST_ACCESS_BIT_KHR;
+            attrs[n++] = EGL_CONTEXT_OPENGL_RESET_NOTIFICATION_STRATEGY_KHR;
+            attrs[n++] = EGL_LOSE_CONTEXT_ON_RESET_KHR;
+        }
+        else if (glctx_has_extension(ctx,
+                "EGL_EXT_create_context_robustness"))
+        {
+            attrs[n++] = EGL_CONTEXT_OPENGL_ROBUST_ACCESS_EXT;
+            attrs[n++] = EGL_TRUE;
+            attrs[n++] = EGL_CONTEXT_OPENGL_RESET_NOTIFICATION_STRATEGY_EXT;
+            attrs[n++] = EGL_LOSE_CONTEXT_ON_RESET_EXT;
+        }
+        else
+        {
+            glctx__log("glctx: Robust contexts not supported\n");
+        }
+    }
+    if (flag_bits)
+    {
+        attrs[n++] = EGL_CONTEXT_FLAGS_KHR;
+        attrs[n++] = flag_bits;
+    }
+    if (ctx->flags & GLCTX_CONTEXT_NO_ERROR)
+    {
+        if (glctx_has_extension(ctx, "EGL_KHR_create_context_no_error"))
+        {
+            attrs[n++] = EGL_CONTEXT_OPENGL_NO_ERROR_KHR;
+            attrs[n++] = EGL_TRUE;
+        }
+        else
+        {
+            glctx__log("glctx: No-error contexts not supported\n");
+        }
+    }
+    if (ctx->flags & GLCTX_CONTEXT_NO_FLUSH)
+    {
+        if (glctx_has_extension(ctx, "EGL_KHR_context_flush_control"))
+        {
+            attrs[n++] = EGL_CONTEXT_RELEASE_BEHAVIOR_KHR;
+            attrs[n++] = EGL_CONTEXT_RELEASE_BEHAVIOR_NONE_KHR;
+        }
+        else
+        {
+            glctx__log("glctx: Context flush control not supported\n");
+        }
+    }
+    attrs[n] = EGL_NONE;
+}
+
+GlctxError glctx_activate(GlctxHandle ctx, GlctxConfig config,
+        GlctxWindow window, const int *attrs)
+{
+    EGLint default_attrs[13];
+    GlctxError result = GLCTX_ERROR_NONE;
+
+    ctx->window = window;
+    ctx->config = config;
+    if (!attrs)
+    {
+        glctx_make_context_attrs(ctx, default_attrs);
+        attrs = default_attrs;
+    }
+    if (!glctx_bind_api(ctx))
+        return GLCTX_ERROR_PROFILE;
+
+    if (ctx->headless)
+        result = glctx_create_headless_surface(ctx, config);
+    else
+        result = glctx_create_window_surface(ctx, config);
+    if (result)
+        return result;
 
     ctx->context = eglCreateContext(ctx->display, config,
             EGL_NO_CONTEXT, attrs);
@@ -290,35 +936,362 @@ GlctxError glctx_activate(GlctxHandle ctx, GlctxConfig config,
     return glctx_bind(ctx);
 }
 
-#if 0
-int glctx_get_width(GlctxHandle ctx)
+/*
+ * Replaces *config, eg a window-only config, with one that has the same
+ * client APIs and buffer sizes and supports pbuffers
+ */
+static GlctxError glctx_find_pbuffer_config(GlctxHandle ctx,
+        EGLConfig *config)
 {
-    EGLint w;
-    if (!eglQuerySurface(ctx->display, ctx->surface, EGL_WIDTH, &w))
+    static const EGLint sizes[] = {
+        EGL_RED_SIZE, EGL_GREEN_SIZE, EGL_BLUE_SIZE, EGL_ALPHA_SIZE,
+        EGL_DEPTH_SIZE, EGL_STENCIL_SIZE, EGL_SAMPLES
+    };
+    EGLint attrs[2 * 9 + 1];
+    EGLConfig *configs;
+    EGLint n_configs = 0;
+    int n_sizes = (int) (sizeof(sizes) / sizeof(sizes[0]));
+    int a = 0;
+    int n, i;
+
+    for (i = 0; i < n_sizes; ++i)
+    {
+        attrs[a++] = sizes[i];
+        attrs[a++] = glctx_get_config_attrib(ctx, *config, sizes[i]);
+    }
+    attrs[a++] = EGL_RENDERABLE_TYPE;
+    attrs[a++] = glctx_get_config_attrib(ctx, *config, EGL_RENDERABLE_TYPE);
+    attrs[a++] = EGL_SURFACE_TYPE;
+    attrs[a++] = EGL_PBUFFER_BIT;
+    attrs[a] = EGL_NONE;
+    if (!eglChooseConfig(ctx->display, attrs, NULL, 0, &n_configs) ||
+            n_configs < 1)
     {
-        glctx__log("glctx: Unable to get width of EGL surface\n");
-        return -1;
+        glctx__log("glctx: No pbuffer config matches the parent's, and "
+                "EGL_KHR_surfaceless_context isn't supported\n");
+        return GLCTX_ERROR_CONFIG;
     }
-    return w;
+    configs = malloc(sizeof(EGLConfig) * n_configs);
+    if (!configs)
+        return GLCTX_ERROR_MEMORY;
+    eglChooseConfig(ctx->display, attrs, configs, n_configs, &n_configs);
+    /* Sizes are minimums and larger color buffers sort first */
+    for (n = 0; n < n_configs; ++n)
+    {
+        for (i = 0; i < n_sizes; ++i)
+        {
+            if (glctx_get_config_attrib(ctx, configs[n], sizes[i]) !=
+                    attrs[2 * i + 1])
+            {
+                break;
+            }
+        }
+        if (i == n_sizes)
+            break;
+    }
+    if (n == n_configs)
+    {
+        free(configs);
+        glctx__log("glctx: No pbuffer config has the parent's sizes, and "
+                "EGL_KHR_surfaceless_context isn't supported\n");
+        return GLCTX_ERROR_CONFIG;
+    }
+    glctx__log("glctx: Using pbuffer config ID %d for worker\n",
+            glctx_get_config_attrib(ctx, configs[n], EGL_CONFIG_ID));
+    *config = configs[n];
+    free(configs);
+    return GLCTX_ERROR_NONE;
 }
 
-int glctx_get_height(GlctxHandle ctx)
+GlctxError glctx_create_shared(GlctxHandle ctx, GlctxHandle *pctx)
 {
-    EGLint h;
-    if (!eglQuerySurface(ctx->display, ctx->surface, EGL_HEIGHT, &h))
+    GlctxHandle worker;
+    EGLint attrs[13];
+    GlctxError result;
+
+    *pctx = NULL;
+    if (ctx->context == EGL_NO_CONTEXT)
+        return GLCTX_ERROR_CONTEXT;
+    worker = malloc(sizeof(struct GlctxData_));
+    if (!worker)
+        return GLCTX_ERROR_MEMORY;
+    *worker = *ctx;
+    worker->surface = EGL_NO_SURFACE;
+    worker->surfaces = worker->draw = worker->read = NULL;
+    worker->context = EGL_NO_CONTEXT;
+    worker->window = 0;
+    worker->headless = 1;
+    worker->width = worker->height = 1;
+    worker->dispatch = NULL;
+    /* Can't fail because ctx already holds a reference */
+    glctx_acquire_display(worker->display);
+
+    if (!glctx_bind_api(worker))
+    {
+        glctx_terminate(worker);
+        return GLCTX_ERROR_PROFILE;
+    }
+    if (!glctx_has_extension(worker, "EGL_KHR_surfaceless_context") &&
+            !(glctx_get_config_attrib(worker, worker->config,
+                    EGL_SURFACE_TYPE) & EGL_PBUFFER_BIT))
     {
-        glctx__log("glctx: Unable to get height of EGL surface\n");
-        return -1;
+        result = glctx_find_pbuffer_config(worker, &worker->config);
+        if (result)
+        {
+            glctx_terminate(worker);
+            return result;
+        }
     }
-    return h;
+    result = glctx_create_headless_surface(worker, worker->config);
+    if (result)
+    {
+        glctx_terminate(worker);
+        return result;
+    }
+    glctx_make_context_attrs(worker, attrs);
+    worker->context = eglCreateContext(worker->display, worker->config,
+            ctx->context, attrs);
+    if (worker->context == EGL_NO_CONTEXT)
+    {
+        glctx__log("glctx: Unable to create shared context with EGL\n");
+        glctx_terminate(worker);
+        return GLCTX_ERROR_CONTEXT;
+    }
+    *pctx = worker;
+    return GLCTX_ERROR_NONE;
 }
+
+static GlctxError glctx_add_surface(GlctxHandle ctx, EGLSurface surface,
+        GlctxSurface *psurf)
+{
+    GlctxSurface surf;
+
+    if (surface == EGL_NO_SURFACE)
+    {
+        glctx__log("glctx: Unable to create EGL surface (0x%x)\n",
+                eglGetError());
+        return GLCTX_ERROR_SURFACE;
+    }
+    surf = malloc(sizeof(struct GlctxSurfaceData_));
+    if (!surf)
+    {
+        eglDestroySurface(ctx->display, surface);
+        return GLCTX_ERROR_MEMORY;
+    }
+    surf->surface = surface;
+    glctx_init_size(ctx, surface, &surf->size);
+    surf->next = ctx->surfaces;
+    ctx->surfaces = surf;
+    *psurf = surf;
+    return GLCTX_ERROR_NONE;
+}
+
+GlctxError glctx_attach_window(GlctxHandle ctx,
+        GlctxWindow window, GlctxSurface *psurf)
+{
+    *psurf = NULL;
+#if GLCTX_ENABLE_RPI
+    (void) ctx;
+    (void) window;
+    glctx__log("glctx: Extra window surfaces are not supported on RPi\n");
+    return GLCTX_ERROR_UNSUPPORTED;
+#else
+    if (ctx->context == EGL_NO_CONTEXT)
+        return GLCTX_ERROR_CONTEXT;
+    return glctx_add_surface(ctx, eglCreateWindowSurface(ctx->display,
+            ctx->config, (EGLNativeWindowType) window, 0), psurf);
 #endif
+}
+
+GlctxError glctx_attach_pbuffer(GlctxHandle ctx,
+        int width, int height, GlctxSurface *psurf)
+{
+    EGLint pb_attrs[] = {
+        EGL_WIDTH, width > 0 ? width : 1,
+        EGL_HEIGHT, height > 0 ? height : 1,
+        EGL_NONE
+    };
+
+    *psurf = NULL;
+    if (ctx->context == EGL_NO_CONTEXT)
+        return GLCTX_ERROR_CONTEXT;
+    return glctx_add_surface(ctx, eglCreatePbufferSurface(ctx->display,
+            ctx->config, pb_attrs), psurf);
+}
+
+static EGLSurface glctx_get_surface(GlctxHandle ctx, GlctxSurface surf)
+{
+    return surf ? surf->surface : ctx->surface;
+}
+
+GlctxSizeCache *glctx__get_size_cache(GlctxHandle ctx)
+{
+    return ctx->draw ? &ctx->draw->size : &ctx->size;
+}
+
+int glctx__query_size(GlctxHandle ctx, int *width, int *height)
+{
+    EGLSurface surface = glctx_get_surface(ctx, ctx->draw);
+    EGLint w, h;
+
+    if (surface == EGL_NO_SURFACE ||
+            !eglQuerySurface(ctx->display, surface, EGL_WIDTH, &w) ||
+            !eglQuerySurface(ctx->display, surface, EGL_HEIGHT, &h))
+    {
+        return 0;
+    }
+    *width = w;
+    *height = h;
+    return 1;
+}
+
+static GlctxError glctx_make_current(GlctxHandle ctx)
+{
+    if (!glctx_bind_api(ctx) || !eglMakeCurrent(ctx->display, glctx_get_surface(ctx, ctx->draw),
+            glctx_get_surface(ctx, ctx->read), ctx->context))
+    {
+        glctx__log("glctx: Unable to bind thread to OpenGL(ES)");
+        return GLCTX_ERROR_BIND;
+    }
+    glctx__set_current(ctx);
+    return GLCTX_ERROR_NONE;
+}
+
+GlctxError glctx_set_surfaces(GlctxHandle ctx,
+        GlctxSurface draw, GlctxSurface read)
+{
+    GlctxSurface old_draw = ctx->draw;
+    GlctxSurface old_read = ctx->read;
+    GlctxError result;
+
+    if (draw == old_draw && read == old_read)
+        return GLCTX_ERROR_NONE;
+    ctx->draw = draw;
+    ctx->read = read;
+    if (glctx_get_current() != ctx)
+        return GLCTX_ERROR_NONE;
+    result = glctx_make_current(ctx);
+    if (result)
+    {
+        ctx->draw = old_draw;
+        ctx->read = old_read;
+        glctx_make_current(ctx);
+    }
+    return result;
+}
+
+void glctx_detach_surface(GlctxHandle ctx, GlctxSurface surf)
+{
+    GlctxSurface *psurf;
+
+    if (!surf)
+        return;
+    if (ctx->draw == surf || ctx->read == surf)
+    {
+        glctx_set_surfaces(ctx, ctx->draw == surf ? NULL : ctx->draw,
+                ctx->read == surf ? NULL : ctx->read);
+    }
+    for (psurf = &ctx->surfaces; *psurf; psurf = &(*psurf)->next)
+    {
+        if (*psurf == surf)
+        {
+            *psurf = surf->next;
+            break;
+        }
+    }
+    eglDestroySurface(ctx->display, surf->surface);
+    free(surf);
+}
+
+void *glctx__native_fence_insert(GlctxHandle ctx)
+{
+    eglCreateSyncKHRProc create_sync;
+
+    if (!glctx_has_extension(ctx, "EGL_KHR_fence_sync"))
+        return NULL;
+    create_sync = (eglCreateSyncKHRProc)
+            glctx_get_proc_address(ctx, "eglCreateSyncKHR");
+    return create_sync ?
+            create_sync(ctx->display, EGL_SYNC_FENCE_KHR, NULL) : NULL;
+}
+
+GlctxError glctx__native_fence_wait(GlctxHandle ctx, void *sync,
+        int gpu, long long timeout_ns)
+{
+    eglClientWaitSyncKHRProc client_wait_sync;
+    EGLint status;
+
+    if (gpu && glctx_has_extension(ctx, "EGL_KHR_wait_sync"))
+    {
+        eglWaitSyncKHRProc wait_sync = (eglWaitSyncKHRProc)
+                glctx_get_proc_address(ctx, "eglWaitSyncKHR");
+
+        if (wait_sync && wait_sync(ctx->display, sync, 0))
+            return GLCTX_ERROR_NONE;
+    }
+    client_wait_sync = (eglClientWaitSyncKHRProc)
+            glctx_get_proc_address(ctx, "eglClientWaitSyncKHR");
+    if (!client_wait_sync)
+        return GLCTX_ERROR_UNSUPPORTED;
+    status = client_wait_sync(ctx->display, sync,
+            EGL_SYNC_FLUSH_COMMANDS_BIT_KHR,
+            timeout_ns < 0 ? ~0ull /* EGL_FOREVER_KHR */ :
+                    (unsigned long long) timeout_ns);
+    if (status == EGL_CONDITION_SATISFIED_KHR)
+        return GLCTX_ERROR_NONE;
+    if (status == EGL_TIMEOUT_EXPIRED_KHR)
+        return GLCTX_ERROR_TIMEOUT;
+    glctx__log("glctx: eglClientWaitSyncKHR failed (0x%x)\n", eglGetError());
+    return GLCTX_ERROR_CONTEXT;
+}
+
+void glctx__native_fence_destroy(GlctxHandle ctx, void *sync)
+{
+    eglDestroySyncKHRProc destroy_sync = (eglDestroySyncKHRProc)
+            glctx_get_proc_address(ctx, "eglDestroySyncKHR");
+
+    if (destroy_sync)
+        destroy_sync(ctx->display, sync);
+}
 
 GlctxNativeContext glctx_get_native_context(GlctxHandle ctx)
 {
     return ctx->context;
 }
 
+GlctxDispatch **glctx__get_dispatch(GlctxHandle ctx)
+{
+    return &ctx->dispatch;
+}
+
+GlctxProc glctx__get_native_proc(const char *name)
+{
+    return (GlctxProc) eglGetProcAddress(name);
+}
+
+int glctx__get_native_extensions(GlctxHandle ctx,
+        const char **strings, int max)
+{
+    int n = 0;
+
+    /* Client extensions are only available with EGL_EXT_client_extensions */
+    if (n < max)
+        strings[n] = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if (n < max && strings[n])
+        ++n;
+    if (n < max)
+        strings[n] = eglQueryString(ctx->display, EGL_EXTENSIONS);
+    if (n < max && strings[n])
+        ++n;
+    return n;
+}
+
+void glctx__get_display_key(GlctxHandle ctx, void **display, int *screen)
+{
+    *display = ctx->display;
+    *screen = 0;
+}
+
 EGLDisplay glctx_get_egl_display(GlctxHandle ctx)
 {
     return ctx->display;
@@ -331,45 +1304,126 @@ EGLSurface glctx_get_egl_surface(GlctxHandle ctx)
 
 void glctx_flip(GlctxHandle ctx)
 {
-    eglSwapBuffers(ctx->display, ctx->surface);
+    EGLSurface surface = glctx_get_surface(ctx, ctx->draw);
+
+    if (surface != EGL_NO_SURFACE)
+        eglSwapBuffers(ctx->display, surface);
+}
+
+void glctx_flip_damage(GlctxHandle ctx, const int *rects, int n)
+{
+    EGLSurface surface = glctx_get_surface(ctx, ctx->draw);
+    eglSwapBuffersWithDamageProc swap_with_damage = NULL;
+
+    if (surface == EGL_NO_SURFACE)
+        return;
+    if (glctx_has_extension(ctx, "EGL_KHR_swap_buffers_with_damage"))
+    {
+        swap_with_damage = (eglSwapBuffersWithDamageProc)
+                glctx_get_proc_address(ctx, "eglSwapBuffersWithDamageKHR");
+    }
+    else if (glctx_has_extension(ctx, "EGL_EXT_swap_buffers_with_damage"))
+    {
+        swap_with_damage = (eglSwapBuffersWithDamageProc)
+                glctx_get_proc_address(ctx, "eglSwapBuffersWithDamageEXT");
+    }
+    if (!swap_with_damage || n <= 0 ||
+            !swap_with_damage(ctx->display, surface, rects, n))
+    {
+        eglSwapBuffers(ctx->display, surface);
+    }
+}
+
+GlctxError glctx_set_damage_region(GlctxHandle ctx, const int *rects, int n)
+{
+    EGLSurface surface = glctx_get_surface(ctx, ctx->draw);
+    eglSetDamageRegionKHRProc set_damage_region = NULL;
+
+    if (surface != EGL_NO_SURFACE &&
+            glctx_has_extension(ctx, "EGL_KHR_partial_update"))
+    {
+        set_damage_region = (eglSetDamageRegionKHRProc)
+                glctx_get_proc_address(ctx, "eglSetDamageRegionKHR");
+    }
+    if (!set_damage_region)
+        return GLCTX_ERROR_UNSUPPORTED;
+    if (!set_damage_region(ctx->display, surface, (EGLint *) rects, n))
+    {
+        glctx__log("glctx: eglSetDamageRegionKHR failed (0x%x)\n",
+                eglGetError());
+        return GLCTX_ERROR_SURFACE;
+    }
+    return GLCTX_ERROR_NONE;
+}
+
+int glctx_get_buffer_age(GlctxHandle ctx)
+{
+    EGLSurface surface = glctx_get_surface(ctx, ctx->draw);
+    EGLint age = 0;
+
+    /* EGL_KHR_partial_update defines the same query */
+    if (surface == EGL_NO_SURFACE ||
+            (!glctx_has_extension(ctx, "EGL_EXT_buffer_age") &&
+            !glctx_has_extension(ctx, "EGL_KHR_partial_update")) ||
+            !eglQuerySurface(ctx->display, surface, EGL_BUFFER_AGE_EXT, &age))
+    {
+        return 0;
+    }
+    return age;
+}
+
+GlctxError glctx_set_swap_interval(GlctxHandle ctx, int interval)
+{
+    if (interval < 0)
+    {
+        glctx__log("glctx: EGL doesn't support adaptive vsync\n");
+        interval = 1;
+    }
+    if (!eglSwapInterval(ctx->display, interval))
+    {
+        glctx__log("glctx: eglSwapInterval failed (0x%x)\n", eglGetError());
+        return GLCTX_ERROR_SURFACE;
+    }
+    return GLCTX_ERROR_NONE;
 }
 
 GlctxError glctx_unbind(GlctxHandle ctx)
 {
-    if (!eglMakeCurrent(ctx->display,
+    if (glctx_get_current() != ctx)
+        return GLCTX_ERROR_NONE;
+    if (!glctx_bind_api(ctx) || !eglMakeCurrent(ctx->display,
             EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT))
     {
         glctx__log("glctx: Unable to unbind thread from OpenGL(ES)");
         return GLCTX_ERROR_BIND;
     }
+    glctx__set_current(NULL);
     return GLCTX_ERROR_NONE;
 }
 
 GlctxError glctx_bind(GlctxHandle ctx)
 {
-    if (!eglMakeCurrent(ctx->display,
-            ctx->surface, ctx->surface, ctx->context))
-    {
-        glctx__log("glctx: Unable to bind thread to OpenGL(ES)");
-        return GLCTX_ERROR_BIND;
-    }
-    return GLCTX_ERROR_NONE;
+    if (glctx_get_current() == ctx)
+        return GLCTX_ERROR_NONE;
+    return glctx_make_current(ctx);
 }
 
 void glctx_terminate(GlctxHandle ctx)
 {
     if (ctx->display != EGL_NO_DISPLAY)
     {
-        eglMakeCurrent(ctx->display,
-                EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        glctx_unbind(ctx);
         if (ctx->context != EGL_NO_CONTEXT)
             eglDestroyContext(ctx->display, ctx->context);
+        while (ctx->surfaces)
+            glctx_detach_surface(ctx, ctx->surfaces);
         if (ctx->surface != EGL_NO_SURFACE)
         {
             eglDestroySurface(ctx->display, ctx->surface);
             ctx->surface = EGL_NO_SURFACE;
         }
-        eglTerminate(ctx->display);
+        glctx_release_display(ctx->display);
     }
+    glctx__free_dispatch(ctx->dispatch);
     free(ctx);
 }
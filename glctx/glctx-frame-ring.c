@@ -0,0 +1,287 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE     /* memfd_create */
+#endif
+
+#include "glctx-private.h"
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define GLCTX_HAVE_MEMFD 1
+#else
+#define GLCTX_HAVE_MEMFD 0
+#endif
+
+/* Cache line alignment keeps the counters and slots from false sharing */
+#define GLCTX_FRAME_RING_ALIGN 64
+
+struct GlctxFrameRing_ {
+    GlctxFrameRingHeader *hdr;
+    int fd;
+    GlctxReadback readback;
+};
+
+static unsigned long long glctx_align(unsigned long long n)
+{
+    return (n + GLCTX_FRAME_RING_ALIGN - 1) &
+            ~(unsigned long long) (GLCTX_FRAME_RING_ALIGN - 1);
+}
+
+#if GLCTX_HAVE_MEMFD
+/*
+ * Checks a header's layout fits in size bytes, so a consumer can't be made
+ * to read outside its mapping by a bad header. The sums are done in 64 bits
+ * and can't overflow with 32-bit fields.
+ */
+static int glctx_frame_ring_check_layout(const GlctxFrameRingHeader *hdr,
+        unsigned long long size)
+{
+    return hdr->n_slots > 0 &&
+            hdr->stride >= 4ULL * hdr->width &&
+            hdr->slot_offset >= sizeof(GlctxFrameRingHeader) &&
+            hdr->pixel_offset >= sizeof(GlctxFrameSlot) &&
+            hdr->pixel_offset + (unsigned long long) hdr->stride *
+                    hdr->height <= hdr->slot_size &&
+            hdr->slot_offset + (unsigned long long) hdr->slot_size *
+                    hdr->n_slots <= hdr->map_size &&
+            hdr->map_size <= size && hdr->map_size <= SIZE_MAX;
+}
+#endif
+
+static GlctxFrameSlot *glctx_frame_ring_slot(const GlctxFrameRingHeader *hdr,
+        unsigned int seq)
+{
+    return (GlctxFrameSlot *) ((char *) hdr + hdr->slot_offset +
+            (size_t) (seq % hdr->n_slots) * hdr->slot_size);
+}
+
+const void *glctx_frame_ring_get_pixels(const GlctxFrameRingHeader *hdr,
+        const GlctxFrameSlot *slot)
+{
+    return (const char *) slot + hdr->pixel_offset;
+}
+
+#if GLCTX_HAVE_MEMFD
+/* Called with frames in capture order once their fences have signalled */
+static void glctx_frame_ring_publish(const GlctxReadbackFrame *frame,
+        void *data)
+{
+    GlctxFrameRingHeader *hdr = data;
+    unsigned int seq = hdr->write_seq;
+    GlctxFrameSlot *slot;
+
+    if (seq - (unsigned int) glctx__atomic_load_int(
+            (GlctxAtomicInt *) &hdr->read_seq) >= hdr->n_slots)
+    {
+        glctx__atomic_add_int((GlctxAtomicInt *) &hdr->dropped, 1);
+        return;
+    }
+    slot = glctx_frame_ring_slot(hdr, seq);
+    memcpy((char *) slot + hdr->pixel_offset, frame->pixels,
+            (size_t) frame->stride * frame->height);
+    slot->frame = frame->frame;
+    glctx__atomic_store_int((GlctxAtomicInt *) &slot->seq, (int) (seq + 1));
+    glctx__atomic_store_int((GlctxAtomicInt *) &hdr->write_seq,
+            (int) (seq + 1));
+}
+#endif
+
+GlctxError glctx_frame_ring_create(GlctxHandle ctx,
+        int width, int height, int n_slots, GlctxFrameRing *pring)
+{
+#if GLCTX_HAVE_MEMFD
+    GlctxFrameRing ring;
+    GlctxFrameRingHeader hdr;
+    unsigned long long slot_size;
+    GlctxError result;
+    void *map;
+
+    *pring = NULL;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = GLCTX_FRAME_RING_MAGIC;
+    hdr.n_slots = n_slots > 1 ? n_slots : 2;
+    hdr.width = width > 0 ? width : 1;
+    hdr.height = height > 0 ? height : 1;
+    hdr.slot_offset = glctx_align(sizeof(GlctxFrameRingHeader));
+    hdr.pixel_offset = glctx_align(sizeof(GlctxFrameSlot));
+    slot_size = glctx_align(hdr.pixel_offset +
+            4ULL * hdr.width * hdr.height);
+    if (slot_size > UINT_MAX)
+    {
+        glctx__log("glctx: Frame ring slots of %dx%d are too big\n",
+                width, height);
+        return GLCTX_ERROR_UNSUPPORTED;
+    }
+    hdr.stride = hdr.width * 4;
+    hdr.slot_size = (unsigned int) slot_size;
+    hdr.map_size = hdr.slot_offset + slot_size * hdr.n_slots;
+    if (hdr.map_size > SIZE_MAX)
+    {
+        glctx__log("glctx: Frame ring of %d slots is too big\n", n_slots);
+        return GLCTX_ERROR_UNSUPPORTED;
+    }
+
+    ring = calloc(1, sizeof(struct GlctxFrameRing_));
+    if (!ring)
+        return GLCTX_ERROR_MEMORY;
+    ring->fd = memfd_create("glctx-frame-ring", MFD_CLOEXEC);
+    if (ring->fd < 0 || ftruncate(ring->fd, (off_t) hdr.map_size) < 0)
+    {
+        glctx__log("glctx: Unable to create frame ring shared memory\n");
+        if (ring->fd >= 0)
+            close(ring->fd);
+        free(ring);
+        return GLCTX_ERROR_MEMORY;
+    }
+    map = mmap(NULL, hdr.map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+            ring->fd, 0);
+    if (map == MAP_FAILED)
+    {
+        glctx__log("glctx: Unable to map frame ring shared memory\n");
+        close(ring->fd);
+        free(ring);
+        return GLCTX_ERROR_MEMORY;
+    }
+    /* The memfd starts zeroed, so the slots' seqs are already 0 */
+    ring->hdr = map;
+    *ring->hdr = hdr;
+
+    result = glctx_readback_create(ctx, width, height, 3,
+            glctx_frame_ring_publish, ring->hdr, &ring->readback);
+    if (result)
+    {
+        glctx_frame_ring_destroy(ring);
+        return result;
+    }
+    *pring = ring;
+    return GLCTX_ERROR_NONE;
+#else
+    (void) ctx;
+    (void) width;
+    (void) height;
+    (void) n_slots;
+    *pring = NULL;
+    glctx__log("glctx: Frame rings need memfd (Linux)\n");
+    return GLCTX_ERROR_UNSUPPORTED;
+#endif
+}
+
+int glctx_frame_ring_get_fd(GlctxFrameRing ring)
+{
+    return ring->fd;
+}
+
+GlctxError glctx_frame_ring_capture(GlctxFrameRing ring)
+{
+    GlctxError result = glctx_readback_capture(ring->readback);
+
+    glctx_readback_poll(ring->readback);
+    return result;
+}
+
+void glctx_frame_ring_flush(GlctxFrameRing ring)
+{
+    glctx_readback_flush(ring->readback);
+}
+
+void glctx_frame_ring_destroy(GlctxFrameRing ring)
+{
+    if (!ring)
+        return;
+    glctx_readback_destroy(ring->readback);
+#if GLCTX_HAVE_MEMFD
+    munmap(ring->hdr, ring->hdr->map_size);
+    close(ring->fd);
+#endif
+    free(ring);
+}
+
+GlctxError glctx_frame_ring_map(int fd, GlctxFrameRingHeader **phdr)
+{
+#if GLCTX_HAVE_MEMFD
+    GlctxFrameRingHeader hdr;
+    struct stat st;
+    void *map;
+
+    *phdr = NULL;
+    /* Mapping past the end of the file would fault when it's read */
+    if (fstat(fd, &st) < 0 ||
+            (unsigned long long) st.st_size < sizeof(GlctxFrameRingHeader))
+    {
+        glctx__log("glctx: Not a frame ring\n");
+        return GLCTX_ERROR_UNSUPPORTED;
+    }
+    map = mmap(NULL, sizeof(GlctxFrameRingHeader), PROT_READ, MAP_SHARED,
+            fd, 0);
+    if (map == MAP_FAILED)
+        return GLCTX_ERROR_MEMORY;
+    /* Keep a copy to check once this mapping has gone */
+    memcpy(&hdr, map, sizeof(GlctxFrameRingHeader));
+    munmap(map, sizeof(GlctxFrameRingHeader));
+    if (hdr.magic != GLCTX_FRAME_RING_MAGIC)
+    {
+        glctx__log("glctx: Not a frame ring\n");
+        return GLCTX_ERROR_UNSUPPORTED;
+    }
+    if (!glctx_frame_ring_check_layout(&hdr, st.st_size))
+    {
+        glctx__log("glctx: Frame ring header doesn't fit its shared "
+                "memory\n");
+        return GLCTX_ERROR_UNSUPPORTED;
+    }
+    /* Writable because the consumer updates read_seq */
+    map = mmap(NULL, hdr.map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        return GLCTX_ERROR_MEMORY;
+    *phdr = map;
+    return GLCTX_ERROR_NONE;
+#else
+    (void) fd;
+    *phdr = NULL;
+    return GLCTX_ERROR_UNSUPPORTED;
+#endif
+}
+
+void glctx_frame_ring_unmap(GlctxFrameRingHeader *hdr)
+{
+#if GLCTX_HAVE_MEMFD
+    if (hdr)
+        munmap(hdr, hdr->map_size);
+#else
+    (void) hdr;
+#endif
+}
+
+const GlctxFrameSlot *glctx_frame_ring_peek(GlctxFrameRingHeader *hdr)
+{
+    unsigned int seq = hdr->read_seq;
+    GlctxFrameSlot *slot;
+
+    if ((unsigned int) glctx__atomic_load_int(
+            (GlctxAtomicInt *) &hdr->write_seq) == seq)
+    {
+        return NULL;
+    }
+    slot = glctx_frame_ring_slot(hdr, seq);
+    if ((unsigned int) glctx__atomic_load_int(
+            (GlctxAtomicInt *) &slot->seq) != seq + 1)
+    {
+        return NULL;
+    }
+    return slot;
+}
+
+void glctx_frame_ring_release(GlctxFrameRingHeader *hdr)
+{
+    if (glctx_frame_ring_peek(hdr))
+    {
+        glctx__atomic_store_int((GlctxAtomicInt *) &hdr->read_seq,
+                (int) (hdr->read_seq + 1));
+    }
+}
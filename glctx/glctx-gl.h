@@ -0,0 +1,73 @@
+#ifndef GLCTX_GL_H
+#define GLCTX_GL_H
+
+/*
+ * OpenGL(ES) entry points used internally by glcontext. These are resolved
+ * lazily, per handle, with glctx__gl_proc so the library doesn't have to
+ * link to libGL/libGLESv2 or include their headers. To add a function, add
+ * a GLCTX_GL_PROC(return_type, name_without_gl, (params)) line; the enum,
+ * typedef and name table are generated from this list.
+ *
+ * Call through GLCTX_GL, eg GLCTX_GL(ctx, Flush)();
+ */
+
+#include <stddef.h>
+
+#if defined(_WIN32) && !defined(__CYGWIN__)
+#define GLCTX_GL_APIENTRY __stdcall
+#else
+#define GLCTX_GL_APIENTRY
+#endif
+
+#define GLCTX_GL_PROCS \
+    GLCTX_GL_PROC(unsigned int, GetError, (void)) \
+    GLCTX_GL_PROC(const unsigned char *, GetString, (unsigned int name)) \
+    GLCTX_GL_PROC(const unsigned char *, GetStringi, \
+            (unsigned int name, unsigned int index)) \
+    GLCTX_GL_PROC(void, GetIntegerv, (unsigned int pname, int *data)) \
+    GLCTX_GL_PROC(void, Flush, (void)) \
+    GLCTX_GL_PROC(void, Finish, (void)) \
+    GLCTX_GL_PROC(void *, FenceSync, (unsigned int condition, \
+            unsigned int flags)) \
+    GLCTX_GL_PROC(unsigned int, ClientWaitSync, (void *sync, \
+            unsigned int flags, unsigned long long timeout)) \
+    GLCTX_GL_PROC(void, WaitSync, (void *sync, unsigned int flags, \
+            unsigned long long timeout)) \
+    GLCTX_GL_PROC(void, DeleteSync, (void *sync)) \
+    GLCTX_GL_PROC(void, ReadPixels, (int x, int y, int width, int height, \
+            unsigned int format, unsigned int type, void *pixels)) \
+    GLCTX_GL_PROC(void, GenBuffers, (int n, unsigned int *buffers)) \
+    GLCTX_GL_PROC(void, DeleteBuffers, (int n, const unsigned int *buffers)) \
+    GLCTX_GL_PROC(void, BindBuffer, (unsigned int target, \
+            unsigned int buffer)) \
+    GLCTX_GL_PROC(void, BufferData, (unsigned int target, ptrdiff_t size, \
+            const void *data, unsigned int usage)) \
+    GLCTX_GL_PROC(void *, MapBufferRange, (unsigned int target, \
+            ptrdiff_t offset, ptrdiff_t length, unsigned int access)) \
+    GLCTX_GL_PROC(unsigned char, UnmapBuffer, (unsigned int target)) \
+    GLCTX_GL_PROC(void, GenTextures, (int n, unsigned int *textures)) \
+    GLCTX_GL_PROC(void, DeleteTextures, (int n, \
+            const unsigned int *textures)) \
+    GLCTX_GL_PROC(void, BindTexture, (unsigned int target, \
+            unsigned int texture)) \
+    GLCTX_GL_PROC(void, TexParameteri, (unsigned int target, \
+            unsigned int pname, int param)) \
+    GLCTX_GL_PROC(void, EGLImageTargetTexture2DOES, (unsigned int target, \
+            void *image))
+
+typedef enum {
+#define GLCTX_GL_PROC(ret, name, params) GLCTX_GL_##name,
+    GLCTX_GL_PROCS
+#undef GLCTX_GL_PROC
+    GLCTX_GL_N_PROCS
+} GlctxGLProcId;
+
+#define GLCTX_GL_PROC(ret, name, params) \
+    typedef ret (GLCTX_GL_APIENTRY *GlctxGLProc_##name) params;
+GLCTX_GL_PROCS
+#undef GLCTX_GL_PROC
+
+#define GLCTX_GL(ctx, name) \
+    ((GlctxGLProc_##name) glctx__gl_proc((ctx), GLCTX_GL_##name))
+
+#endif /* GLCTX_GL_H */
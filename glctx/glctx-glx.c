@@ -1,14 +1,37 @@
-#include "glctx.h"
+#include "glctx-private.h"
 
 #include "GL/glx.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-extern int (*glctx__log)(const char *format, ...);
-extern int glctx__log_ignore(const char *format, ...);
-extern int *glctx__make_attrs_buffer(const int *attrs,
-        const int *native_attrs, int native_attr_term);
+#ifndef GLX_BIND_TO_TEXTURE_RGBA_EXT
+#define GLX_TEXTURE_2D_BIT_EXT 0x00000002
+#define GLX_BIND_TO_TEXTURE_RGB_EXT 0x20D0
+#define GLX_BIND_TO_TEXTURE_RGBA_EXT 0x20D1
+#define GLX_BIND_TO_TEXTURE_TARGETS_EXT 0x20D3
+#define GLX_Y_INVERTED_EXT 0x20D4
+#define GLX_TEXTURE_FORMAT_EXT 0x20D5
+#define GLX_TEXTURE_TARGET_EXT 0x20D6
+#define GLX_TEXTURE_FORMAT_RGB_EXT 0x20D9
+#define GLX_TEXTURE_FORMAT_RGBA_EXT 0x20DA
+#define GLX_TEXTURE_2D_EXT 0x20DC
+#define GLX_FRONT_LEFT_EXT 0x20DE
+#endif
+#ifndef GLX_RENDERER_VENDOR_ID_MESA
+#define GLX_RENDERER_VENDOR_ID_MESA 0x8183
+#define GLX_RENDERER_DEVICE_ID_MESA 0x8184
+#define GLX_RENDERER_VERSION_MESA 0x8185
+#endif
+
+#define GLCTX_TEXTURE_2D 0x0DE1
+#define GLCTX_TEXTURE_BINDING_2D 0x8069
+#define GLCTX_TEXTURE_MIN_FILTER 0x2801
+#define GLCTX_LINEAR 0x2601
+
+/* Depths of pixmaps that may be bound, usually 24 and 32 */
+#define GLCTX_PIXMAP_DEPTHS 4
 
 static int glctx__attr_table[] = {
     None,
@@ -27,14 +50,48 @@ static int glctx__profile_table[] = {
     0x0002
 };
 
+struct GlctxSurfaceData_ {
+    GLXDrawable drawable;
+    GLXPbuffer pbuffer;
+    GlctxSizeCache size;
+    struct GlctxSurfaceData_ *next;
+};
+
+typedef struct GlctxPixmapBinding_ {
+    Pixmap pixmap;
+    GLXPixmap glx_pixmap;
+    unsigned int texture;
+    int y_inverted;
+    int damaged;
+    struct GlctxPixmapBinding_ *next;
+} GlctxPixmapBinding;
+
+typedef struct {
+    int depth;                  /* 0 if unused */
+    GLXFBConfig config;         /* NULL if the depth can't be bound */
+    int y_inverted;
+} GlctxPixmapConfig;
+
 struct GlctxData_ {
     Display *dpy;
+    int own_dpy;
     Window window;
+    GLXPbuffer pbuffer;
+    GLXDrawable drawable;
+    GlctxSizeCache size;
+    GlctxSurface surfaces;
+    GlctxSurface draw, read;
+    int headless;
     int screen;
     int width, height;
     GLXContext ctx;
+    GLXFBConfig config;
     GlctxProfile profile;
     int maj_version, min_version;
+    int flags;
+    GlctxDispatch *dispatch;
+    GlctxPixmapBinding *pixmaps;
+    GlctxPixmapConfig pixmap_configs[GLCTX_PIXMAP_DEPTHS];
 };
 
 static void glctx_bind_xwindow(GlctxHandle ctx, Window window)
@@ -69,6 +126,17 @@ GlctxError glctx_init(GlctxDisplay display, GlctxWindow window,
     if (!ctx)
         return GLCTX_ERROR_MEMORY;
     ctx->dpy = display;
+    ctx->own_dpy = 0;
+    ctx->pbuffer = None;
+    ctx->drawable = None;
+    glctx__set_size(&ctx->size, 0, 0);
+    ctx->surfaces = ctx->draw = ctx->read = NULL;
+    ctx->headless = 0;
+    ctx->ctx = NULL;
+    ctx->flags = 0;
+    ctx->dispatch = NULL;
+    ctx->pixmaps = NULL;
+    memset(ctx->pixmap_configs, 0, sizeof(ctx->pixmap_configs));
     glctx_bind_xwindow(ctx, window);
     ctx->profile = profile;
     ctx->maj_version = maj_version;
@@ -77,16 +145,63 @@ GlctxError glctx_init(GlctxDisplay display, GlctxWindow window,
     return GLCTX_ERROR_NONE;
 }
 
-GlctxError glctx_get_config(GlctxHandle ctx, GlctxConfig *cfg_out,
+static GlctxMutex glctx_init_threads_lock = GLCTX_MUTEX_INITIALIZER;
+static int glctx_init_threads_done = 0;
+
+/*
+ * Workers share their parent's Display and may be bound on other threads,
+ * which Xlib only allows if XInitThreads was called before opening it.
+ * XInitThreads itself isn't thread-safe in older libX11s.
+ */
+static void glctx_init_threads(void)
+{
+    glctx__mutex_lock(&glctx_init_threads_lock);
+    if (!glctx_init_threads_done)
+    {
+        if (!XInitThreads())
+            glctx__log("glctx: XInitThreads failed\n");
+        glctx_init_threads_done = 1;
+    }
+    glctx__mutex_unlock(&glctx_init_threads_lock);
+}
+
+GlctxError glctx_init_headless(GlctxProfile profile,
+        int maj_version, int min_version, int width, int height,
+        GlctxHandle *pctx)
+{
+    Display *dpy;
+    GlctxError result;
+
+    *pctx = NULL;
+    glctx_init_threads();
+    dpy = XOpenDisplay(NULL);
+    if (!dpy)
+    {
+        glctx__log("glctx: Unable to open X display for headless context\n");
+        return GLCTX_ERROR_DISPLAY;
+    }
+    result = glctx_init(dpy, 0, profile, maj_version, min_version, pctx);
+    if (result)
+    {
+        XCloseDisplay(dpy);
+        return result;
+    }
+    (*pctx)->own_dpy = 1;
+    (*pctx)->headless = 1;
+    (*pctx)->width = width > 0 ? width : 1;
+    (*pctx)->height = height > 0 ? height : 1;
+    glctx__log("glctx: Initialised headless GLX display (pbuffer %dx%d)\n",
+            (*pctx)->width, (*pctx)->height);
+    return GLCTX_ERROR_NONE;
+}
+
+/* Returns a buffer which must be freed if it isn't attrs */
+static int *glctx_make_config_attrs(GlctxHandle ctx,
         const int *attrs, int native_attrs)
 {
-    int fbc_count;
-    GLXFBConfig* fbc;
-    int n, i;
-    int best_nsamples = -1;
-    static const int default_attrs[] = {
+    const int default_attrs[] = {
         GLX_X_RENDERABLE    , True,
-        GLX_DRAWABLE_TYPE   , GLX_WINDOW_BIT,
+        GLX_DRAWABLE_TYPE   , ctx->headless ? GLX_PBUFFER_BIT : GLX_WINDOW_BIT,
         GLX_RENDER_TYPE     , GLX_RGBA_BIT,
         GLX_X_VISUAL_TYPE   , GLX_TRUE_COLOR,
         /*
@@ -97,139 +212,322 @@ GlctxError glctx_get_config(GlctxHandle ctx, GlctxConfig *cfg_out,
         None
     };
     int *all_attrs;
+    int n, i = 0;
 
-    if (native_attrs)
+    if (native_attrs && attrs)
+        return (int *) attrs;
+    all_attrs = glctx__make_attrs_buffer(native_attrs ? NULL : attrs,
+            default_attrs, None);
+    if (!all_attrs)
+        return NULL;
+    if (attrs && !native_attrs)
     {
-        all_attrs = (int *) default_attrs;
-    }
-    else
-    {
-        all_attrs = glctx__make_attrs_buffer(attrs, default_attrs, None);
-        i = 0;
-        if (attrs)
+        for (n = 0; attrs[n]; n += 2)
         {
-            for (n = 0; attrs[n]; n += 2)
-            {
-                all_attrs[i++] = glctx__attr_table[attrs[n]];
-                all_attrs[i++] = attrs[n + 1];
-            }
+            all_attrs[i++] = glctx__attr_table[attrs[n]];
+            all_attrs[i++] = attrs[n + 1];
         }
-        for (n = 0; default_attrs[n] != None; n += 2)
-        {
-            all_attrs[i++] = default_attrs[n];
-            all_attrs[i++] = default_attrs[n + 1];
-        }
-        all_attrs[i] = None;
     }
+    for (n = 0; default_attrs[n] != None; n += 2)
+    {
+        all_attrs[i++] = default_attrs[n];
+        all_attrs[i++] = default_attrs[n + 1];
+    }
+    all_attrs[i] = None;
+    return all_attrs;
+}
+
+GlctxError glctx_get_config(GlctxHandle ctx, GlctxConfig *cfg_out,
+        const int *attrs, int native_attrs)
+{
+    return glctx_choose_config(ctx, cfg_out, attrs, native_attrs, 0, NULL);
+}
+
+int glctx_query_config(GlctxHandle ctx, GlctxConfig config, GlctxAttr attr)
+{
+    int val;
+
+    glXGetFBConfigAttrib(ctx->dpy, config, glctx__attr_table[attr], &val);
+    return val;
+}
+
+static int glctx_get_fbconfig_attrib(GlctxHandle ctx, GLXFBConfig config,
+        int attr)
+{
+    int val = 0;
+
+    glXGetFBConfigAttrib(ctx->dpy, config, attr, &val);
+    return val;
+}
+
+void glctx__get_config_info(GlctxHandle ctx, GlctxConfig config,
+        GlctxConfigInfo *info)
+{
+    info->config = config;
+    info->id = glctx_get_fbconfig_attrib(ctx, config, GLX_FBCONFIG_ID);
+    info->red_size = glctx_get_fbconfig_attrib(ctx, config, GLX_RED_SIZE);
+    info->green_size = glctx_get_fbconfig_attrib(ctx, config, GLX_GREEN_SIZE);
+    info->blue_size = glctx_get_fbconfig_attrib(ctx, config, GLX_BLUE_SIZE);
+    info->alpha_size = glctx_get_fbconfig_attrib(ctx, config, GLX_ALPHA_SIZE);
+    info->depth_size = glctx_get_fbconfig_attrib(ctx, config, GLX_DEPTH_SIZE);
+    info->stencil_size = glctx_get_fbconfig_attrib(ctx, config,
+            GLX_STENCIL_SIZE);
+    info->samples = 0;
+    if (glctx_get_fbconfig_attrib(ctx, config, GLX_SAMPLE_BUFFERS))
+        info->samples = glctx_get_fbconfig_attrib(ctx, config, GLX_SAMPLES);
+    /* GLX_FRAMEBUFFER_SRGB_CAPABLE_ARB */
+    info->srgb = glctx_get_fbconfig_attrib(ctx, config, 0x20B2);
+    info->double_buffer = glctx_get_fbconfig_attrib(ctx, config,
+            GLX_DOUBLEBUFFER);
+}
+
+GlctxError glctx_enumerate_configs(GlctxHandle ctx,
+        const int *attrs, int native_attrs,
+        GlctxConfigInfo **pinfos, int *pcount)
+{
+    int *all_attrs = glctx_make_config_attrs(ctx, attrs, native_attrs);
+    int fbc_count = 0;
+    GLXFBConfig *fbc;
+    GlctxConfigInfo *infos;
+    int n;
 
+    *pinfos = NULL;
+    *pcount = 0;
+    if (!all_attrs)
+        return GLCTX_ERROR_MEMORY;
     fbc = glXChooseFBConfig(ctx->dpy, ctx->screen, all_attrs, &fbc_count);
-    if (!native_attrs)
+    if (all_attrs != attrs)
         free(all_attrs);
     if (!fbc || fbc_count < 1)
     {
-        glctx__log("glctx: Unable to get any matching GLX configs\n");
+        if (fbc)
+            XFree(fbc);
         return GLCTX_ERROR_CONFIG;
     }
-
-    for (i = 0; i < fbc_count; ++i)
+    infos = malloc(sizeof(GlctxConfigInfo) * fbc_count);
+    if (!infos)
     {
-        XVisualInfo *vi = glXGetVisualFromFBConfig(ctx->dpy, fbc[i]);
-        if (vi)
-        {
-            int samp_buf, nsamples;
+        XFree(fbc);
+        return GLCTX_ERROR_MEMORY;
+    }
 
-            glXGetFBConfigAttrib(ctx->dpy, fbc[i],
-                    GLX_SAMPLE_BUFFERS, &samp_buf);
-            glXGetFBConfigAttrib(ctx->dpy, fbc[i],
-                    GLX_SAMPLES, &nsamples);
+    for (n = 0; n < fbc_count; ++n)
+        glctx__get_config_info(ctx, fbc[n], &infos[n]);
 
-            if (best_nsamples < 0 || (samp_buf && nsamples > best_nsamples))
-            {
-                *cfg_out = fbc[i];
-                best_nsamples = nsamples;
-            }
+    /* GLXFBConfig is a pointer type, so the list can go */
+    XFree(fbc);
+    *pinfos = infos;
+    *pcount = fbc_count;
+    return GLCTX_ERROR_NONE;
+}
 
-            glctx__log("glctx: Matching fbconfig %d, visual ID 0x%2x: "
-                    "SAMPLE_BUFFERS = %d, SAMPLES = %d%s\n",
-                    i, vi -> visualid, samp_buf, nsamples,
-                    (best_nsamples == nsamples) ? "\t*" : "");
-        }
-        XFree(vi);
-    }
+GlctxError glctx_get_config_by_id(GlctxHandle ctx, int id,
+        GlctxConfig *cfg_out)
+{
+    int attrs[] = {
+        GLX_FBCONFIG_ID, id,
+        None
+    };
+    int fbc_count = 0;
+    GLXFBConfig *fbc = glXChooseFBConfig(ctx->dpy, ctx->screen,
+            attrs, &fbc_count);
 
-    /* GLXFBConfig is a pointer type, so it's safe to free the list of configs
-     * now although we still need one of the configs from the list
-     */
+    if (!fbc || fbc_count < 1)
+    {
+        if (fbc)
+            XFree(fbc);
+        return GLCTX_ERROR_CONFIG;
+    }
+    *cfg_out = fbc[0];
     XFree(fbc);
-
     return GLCTX_ERROR_NONE;
 }
 
-int glctx_query_config(GlctxHandle ctx, GlctxConfig config, GlctxAttr attr)
+typedef Bool (*glXQueryRendererIntegerMESAProc)
+        (Display *, int, int, int, unsigned int *);
+typedef const char *(*glXQueryRendererStringMESAProc)
+        (Display *, int, int, int);
+
+/* The PCI ids and Mesa version identify the GPU and driver build */
+static void glctx_describe_renderer(GlctxHandle ctx, char *buf, size_t size)
 {
-    int val;
+    glXQueryRendererIntegerMESAProc query_integer;
+    glXQueryRendererStringMESAProc query_string;
+    unsigned int vendor_id = 0, device_id = 0;
+    unsigned int version[3] = { 0, 0, 0 };
+    const char *device;
 
-    glXGetFBConfigAttrib(ctx->dpy, config, glctx__attr_table[attr], &val);
-    return val;
+    buf[0] = 0;
+    if (!glctx_has_extension(ctx, "GLX_MESA_query_renderer"))
+        return;
+    query_integer = (glXQueryRendererIntegerMESAProc) glXGetProcAddressARB(
+            (const GLubyte *) "glXQueryRendererIntegerMESA");
+    query_string = (glXQueryRendererStringMESAProc) glXGetProcAddressARB(
+            (const GLubyte *) "glXQueryRendererStringMESA");
+    if (!query_integer || !query_string)
+        return;
+    query_integer(ctx->dpy, ctx->screen, 0, GLX_RENDERER_VENDOR_ID_MESA,
+            &vendor_id);
+    query_integer(ctx->dpy, ctx->screen, 0, GLX_RENDERER_DEVICE_ID_MESA,
+            &device_id);
+    query_integer(ctx->dpy, ctx->screen, 0, GLX_RENDERER_VERSION_MESA,
+            version);
+    device = query_string(ctx->dpy, ctx->screen, 0,
+            GLX_RENDERER_DEVICE_ID_MESA);
+    snprintf(buf, size, "%04x:%04x|%s|%u.%u.%u", vendor_id, device_id,
+            device ? device : "", version[0], version[1], version[2]);
 }
 
-static int glctx_glx_supports_extension(const char *extensions, const char *ext)
+void glctx__describe_driver(GlctxHandle ctx, char *buf, size_t size)
 {
-    const char *start;
-    const char *where, *term;
+    const char *cvendor = glXGetClientString(ctx->dpy, GLX_VENDOR);
+    const char *cversion = glXGetClientString(ctx->dpy, GLX_VERSION);
+    const char *svendor = glXQueryServerString(ctx->dpy, ctx->screen,
+            GLX_VENDOR);
+    const char *sversion = glXQueryServerString(ctx->dpy, ctx->screen,
+            GLX_VERSION);
+    char renderer[256];
 
-    for (start = extensions;;)
-    {
-        where = strstr(start, ext);
-        if (!where)
-            break;
-        term = where + strlen(ext);
-        if ((where == start || *(where - 1) == ' ') &&
-                (*term == ' ' || !*term))
-        {
-            return 1;
-        }
-        start = term;
-    }
-    return 0;
+    glctx_describe_renderer(ctx, renderer, sizeof(renderer));
+    snprintf(buf, size, "GLX|%s|%s|%s|%s|%s|%d|%d|%d.%d|%d",
+            cvendor ? cvendor : "", cversion ? cversion : "",
+            svendor ? svendor : "", sversion ? sversion : "", renderer,
+            ctx->screen, ctx->profile, ctx->maj_version, ctx->min_version,
+            ctx->headless);
 }
 
 typedef GLXContext (*glXCreateContextAttribsARBProc)
         (Display*, GLXFBConfig, GLXContext, Bool, const int *);
-static glXCreateContextAttribsARBProc glXCreateContextAttribsARB = NULL;
-static const char *glctx_glx_extensions = NULL;
 
-GlctxError glctx_activate(GlctxHandle ctx, GlctxConfig config,
-        GlctxWindow window, const int *attrs)
+/*
+ * Resolved once and shared by all displays. Racing threads get the same
+ * value from glXGetProcAddressARB, so it's safe to store it more than once.
+ */
+static void *volatile glctx_create_context_attribs = NULL;
+
+static glXCreateContextAttribsARBProc glctx_get_create_context_attribs(void)
+{
+    void *proc = glctx__atomic_load_ptr(&glctx_create_context_attribs);
+
+    if (!proc)
+    {
+        proc = (void *) glXGetProcAddressARB((const GLubyte *)
+                "glXCreateContextAttribsARB");
+        glctx__atomic_store_ptr(&glctx_create_context_attribs, proc);
+    }
+    return (glXCreateContextAttribsARBProc) proc;
+}
+
+static GLXPbuffer glctx_new_pbuffer(GlctxHandle ctx, int width, int height)
 {
-    int default_attrs[] = {
-            0x9126, glctx__profile_table[ctx->profile],
-            0x2091, ctx->maj_version,
-            0x2092, ctx->min_version,
-            0
+    int pb_attrs[] = {
+        GLX_PBUFFER_WIDTH, width,
+        GLX_PBUFFER_HEIGHT, height,
+        None
     };
-    if (!attrs)
-        attrs = default_attrs;
+    int drawable_type = 0;
 
-    glctx_bind_xwindow(ctx, window);
-    if (!glctx_glx_extensions)
+    /* Avoid provoking an X error if the config can't do pbuffers */
+    glXGetFBConfigAttrib(ctx->dpy, ctx->config, GLX_DRAWABLE_TYPE,
+            &drawable_type);
+    if (!(drawable_type & GLX_PBUFFER_BIT))
+        return None;
+    return glXCreatePbuffer(ctx->dpy, ctx->config, pb_attrs);
+}
+
+static int glctx_create_pbuffer(GlctxHandle ctx)
+{
+    ctx->pbuffer = glctx_new_pbuffer(ctx, ctx->width, ctx->height);
+    if (ctx->pbuffer)
+        ctx->drawable = ctx->pbuffer;
+    return ctx->pbuffer != None;
+}
+
+void glctx_set_context_flags(GlctxHandle ctx, int flags)
+{
+    ctx->flags = glctx__check_context_flags(flags);
+}
+
+/* attrs must have room for 15 values */
+static void glctx_make_context_attrs(GlctxHandle ctx, int *attrs)
+{
+    int flag_bits = 0;
+    int n = 0;
+
+    attrs[n++] = 0x9126;    /* GLX_CONTEXT_PROFILE_MASK_ARB */
+    attrs[n++] = glctx__profile_table[ctx->profile];
+    attrs[n++] = 0x2091;    /* GLX_CONTEXT_MAJOR_VERSION_ARB */
+    attrs[n++] = ctx->maj_version;
+    attrs[n++] = 0x2092;    /* GLX_CONTEXT_MINOR_VERSION_ARB */
+    attrs[n++] = ctx->min_version;
+    if (ctx->flags & GLCTX_CONTEXT_DEBUG)
+        flag_bits |= 0x0001;    /* GLX_CONTEXT_DEBUG_BIT_ARB */
+    if (ctx->flags & GLCTX_CONTEXT_ROBUST)
     {
-        glctx_glx_extensions = glXQueryExtensionsString(ctx->dpy,
-            DefaultScreen(ctx->dpy));
+        if (glctx_has_extension(ctx, "GLX_ARB_create_context_robustness"))
+        {
+            flag_bits |= 0x0004;    /* GLX_CONTEXT_ROBUST_ACCESS_BIT_ARB */
+            attrs[n++] = 0x8256;    /* GLX_CONTEXT_RESET_NOTIFICATION_... */
+            attrs[n++] = 0x8252;    /* GLX_LOSE_CONTEXT_ON_RESET_ARB */
+        }
+        else
+        {
+            glctx__log("glctx: Robust contexts not supported\n");
+        }
     }
-    if (!glXCreateContextAttribsARB)
+    if (flag_bits)
     {
-        glXCreateContextAttribsARB = (glXCreateContextAttribsARBProc)
-                glXGetProcAddressARB((const GLubyte *)
-                        "glXCreateContextAttribsARB");
+        attrs[n++] = 0x2094;    /* GLX_CONTEXT_FLAGS_ARB */
+        attrs[n++] = flag_bits;
+    }
+    if (ctx->flags & GLCTX_CONTEXT_NO_ERROR)
+    {
+        if (glctx_has_extension(ctx, "GLX_ARB_create_context_no_error"))
+        {
+            attrs[n++] = 0x31B3;    /* GLX_CONTEXT_OPENGL_NO_ERROR_ARB */
+            attrs[n++] = True;
+        }
+        else
+        {
+            glctx__log("glctx: No-error contexts not supported\n");
+        }
+    }
+    if (ctx->flags & GLCTX_CONTEXT_NO_FLUSH)
+    {
+        if (glctx_has_extension(ctx, "GLX_ARB_context_flush_control"))
+        {
+            attrs[n++] = 0x2097;    /* GLX_CONTEXT_RELEASE_BEHAVIOR_ARB */
+            attrs[n++] = 0;         /* GLX_CONTEXT_RELEASE_BEHAVIOR_NONE_ARB */
+        }
+        else
+        {
+            glctx__log("glctx: Context flush control not supported\n");
+        }
     }
-    if (!glctx_glx_supports_extension(glctx_glx_extensions,
-            "GLX_ARB_create_context") ||
+    attrs[n] = 0;
+}
+
+GlctxError glctx_activate(GlctxHandle ctx, GlctxConfig config,
+        GlctxWindow window, const int *attrs)
+{
+    glXCreateContextAttribsARBProc glXCreateContextAttribsARB =
+            glctx_get_create_context_attribs();
+    int default_attrs[15];
+
+    if (!ctx->headless)
+        glctx_bind_xwindow(ctx, window);
+    ctx->config = config;
+    if (!glctx_has_extension(ctx, "GLX_ARB_create_context") ||
             !glXCreateContextAttribsARB)
     {
         glctx__log("glctx: GLX_ARB_create_context not supported\n");
         return GLCTX_ERROR_CONTEXT;
     }
+    if (!attrs)
+    {
+        glctx_make_context_attrs(ctx, default_attrs);
+        attrs = default_attrs;
+    }
 
     glctx__log("glctx: Creating context\n");
     ctx->ctx = glXCreateContextAttribsARB(ctx->dpy, config,
@@ -245,53 +543,628 @@ GlctxError glctx_activate(GlctxHandle ctx, GlctxConfig config,
         glctx__log("glctx: Warning: rendering is not direct\n");
     }
 
+    if (ctx->headless)
+    {
+        if (!glctx_create_pbuffer(ctx))
+        {
+            glctx__log("glctx: Unable to create GLX pbuffer\n");
+            return GLCTX_ERROR_SURFACE;
+        }
+    }
+    else
+    {
+        ctx->drawable = ctx->window;
+    }
+    /* Either the pbuffer's size or from glctx_bind_xwindow */
+    glctx__set_size(&ctx->size, ctx->width, ctx->height);
+
     return glctx_bind(ctx);
 }
 
+GlctxError glctx_create_shared(GlctxHandle ctx, GlctxHandle *pctx)
+{
+    glXCreateContextAttribsARBProc glXCreateContextAttribsARB =
+            glctx_get_create_context_attribs();
+    GlctxHandle worker;
+    int attrs[15];
+
+    *pctx = NULL;
+    if (!ctx->ctx || !glXCreateContextAttribsARB)
+        return GLCTX_ERROR_CONTEXT;
+    worker = malloc(sizeof(struct GlctxData_));
+    if (!worker)
+        return GLCTX_ERROR_MEMORY;
+    *worker = *ctx;
+    worker->own_dpy = 0;
+    worker->headless = 1;
+    worker->width = worker->height = 1;
+    worker->pbuffer = None;
+    worker->surfaces = worker->draw = worker->read = NULL;
+    worker->dispatch = NULL;
+    worker->pixmaps = NULL;
+    glctx_make_context_attrs(worker, attrs);
+    worker->ctx = glXCreateContextAttribsARB(worker->dpy, worker->config,
+            ctx->ctx, True, attrs);
+    if (!worker->ctx)
+    {
+        glctx__log("glctx: Unable to create shared GLX context\n");
+        free(worker);
+        return GLCTX_ERROR_CONTEXT;
+    }
+    /* Contexts on different threads may share a window, so the parent's
+     * drawable will do if the config can't make pbuffers.
+     */
+    if (glctx_create_pbuffer(worker))
+        glctx__set_size(&worker->size, 1, 1);
+    else
+        glctx__log("glctx: Shared context will use parent's drawable\n");
+    *pctx = worker;
+    return GLCTX_ERROR_NONE;
+}
+
+static int glctx_get_window_size(GlctxHandle ctx, Window window,
+        int *width, int *height)
+{
+    XWindowAttributes attribs;
+
+    if (!XGetWindowAttributes(ctx->dpy, window, &attribs))
+        return 0;
+    *width = attribs.width;
+    *height = attribs.height;
+    return 1;
+}
+
+static GlctxError glctx_add_surface(GlctxHandle ctx, GLXDrawable drawable,
+        GLXPbuffer pbuffer, int width, int height, GlctxSurface *psurf)
+{
+    GlctxSurface surf = malloc(sizeof(struct GlctxSurfaceData_));
+
+    if (!surf)
+    {
+        if (pbuffer)
+            glXDestroyPbuffer(ctx->dpy, pbuffer);
+        return GLCTX_ERROR_MEMORY;
+    }
+    surf->drawable = drawable;
+    surf->pbuffer = pbuffer;
+    glctx__set_size(&surf->size, width, height);
+    surf->next = ctx->surfaces;
+    ctx->surfaces = surf;
+    *psurf = surf;
+    return GLCTX_ERROR_NONE;
+}
+
+GlctxError glctx_attach_window(GlctxHandle ctx,
+        GlctxWindow window, GlctxSurface *psurf)
+{
+    int width, height;
+
+    *psurf = NULL;
+    if (!ctx->ctx)
+        return GLCTX_ERROR_CONTEXT;
+    if (!window || !glctx_get_window_size(ctx, window, &width, &height))
+    {
+        glctx__log("glctx: Unable to get window attributes\n");
+        return GLCTX_ERROR_WINDOW;
+    }
+    return glctx_add_surface(ctx, window, None, width, height, psurf);
+}
+
+GlctxError glctx_attach_pbuffer(GlctxHandle ctx,
+        int width, int height, GlctxSurface *psurf)
+{
+    GLXPbuffer pbuffer;
+
+    *psurf = NULL;
+    if (!ctx->ctx)
+        return GLCTX_ERROR_CONTEXT;
+    if (width < 1)
+        width = 1;
+    if (height < 1)
+        height = 1;
+    pbuffer = glctx_new_pbuffer(ctx, width, height);
+    if (!pbuffer)
+    {
+        glctx__log("glctx: Unable to create GLX pbuffer\n");
+        return GLCTX_ERROR_SURFACE;
+    }
+    return glctx_add_surface(ctx, pbuffer, pbuffer, width, height, psurf);
+}
+
+static GLXDrawable glctx_get_drawable(GlctxHandle ctx, GlctxSurface surf)
+{
+    return surf ? surf->drawable : ctx->drawable;
+}
+
+GlctxSizeCache *glctx__get_size_cache(GlctxHandle ctx)
+{
+    return ctx->draw ? &ctx->draw->size : &ctx->size;
+}
+
+int glctx__query_size(GlctxHandle ctx, int *width, int *height)
+{
+    if (ctx->draw)
+    {
+        return !ctx->draw->pbuffer && glctx_get_window_size(ctx,
+                ctx->draw->drawable, width, height);
+    }
+    return !ctx->pbuffer && ctx->window &&
+            glctx_get_window_size(ctx, ctx->window, width, height);
+}
+
+static GlctxError glctx_make_current(GlctxHandle ctx)
+{
+    if (!glXMakeContextCurrent(ctx->dpy, glctx_get_drawable(ctx, ctx->draw),
+            glctx_get_drawable(ctx, ctx->read), ctx->ctx))
+    {
+        glctx__log("glctx: Unable to bind thread to GLX context\n");
+        return GLCTX_ERROR_BIND;
+    }
+    glctx__set_current(ctx);
+    return GLCTX_ERROR_NONE;
+}
+
+GlctxError glctx_set_surfaces(GlctxHandle ctx,
+        GlctxSurface draw, GlctxSurface read)
+{
+    GlctxSurface old_draw = ctx->draw;
+    GlctxSurface old_read = ctx->read;
+    GlctxError result;
+
+    if (draw == old_draw && read == old_read)
+        return GLCTX_ERROR_NONE;
+    ctx->draw = draw;
+    ctx->read = read;
+    if (glctx_get_current() != ctx)
+        return GLCTX_ERROR_NONE;
+    result = glctx_make_current(ctx);
+    if (result)
+    {
+        ctx->draw = old_draw;
+        ctx->read = old_read;
+        glctx_make_current(ctx);
+    }
+    return result;
+}
+
+void glctx_detach_surface(GlctxHandle ctx, GlctxSurface surf)
+{
+    GlctxSurface *psurf;
+
+    if (!surf)
+        return;
+    if (ctx->draw == surf || ctx->read == surf)
+    {
+        glctx_set_surfaces(ctx, ctx->draw == surf ? NULL : ctx->draw,
+                ctx->read == surf ? NULL : ctx->read);
+    }
+    for (psurf = &ctx->surfaces; *psurf; psurf = &(*psurf)->next)
+    {
+        if (*psurf == surf)
+        {
+            *psurf = surf->next;
+            break;
+        }
+    }
+    if (surf->pbuffer)
+        glXDestroyPbuffer(ctx->dpy, surf->pbuffer);
+    free(surf);
+}
+
+/* GLX has no fences of its own, so GL sync objects are used */
+void *glctx__native_fence_insert(GlctxHandle ctx)
+{
+    (void) ctx;
+    return NULL;
+}
+
+GlctxError glctx__native_fence_wait(GlctxHandle ctx, void *sync,
+        int gpu, long long timeout_ns)
+{
+    (void) ctx;
+    (void) sync;
+    (void) gpu;
+    (void) timeout_ns;
+    return GLCTX_ERROR_UNSUPPORTED;
+}
+
+void glctx__native_fence_destroy(GlctxHandle ctx, void *sync)
+{
+    (void) ctx;
+    (void) sync;
+}
+
+typedef void (*glXBindTexImageEXTProc)
+        (Display *, GLXDrawable, int, const int *);
+typedef void (*glXReleaseTexImageEXTProc)(Display *, GLXDrawable, int);
+
+/*
+ * Finds a config whose visual has the pixmap's depth and can be bound to a
+ * 2D texture with alpha if the depth is 32. The choice is remembered per
+ * depth because searching needs a round trip per config.
+ */
+static GlctxPixmapConfig *glctx_get_pixmap_config(GlctxHandle ctx, int depth)
+{
+    int attrs[] = {
+        GLX_DRAWABLE_TYPE, GLX_PIXMAP_BIT,
+        GLX_BIND_TO_TEXTURE_TARGETS_EXT, GLX_TEXTURE_2D_BIT_EXT,
+        depth == 32 ? GLX_BIND_TO_TEXTURE_RGBA_EXT :
+                GLX_BIND_TO_TEXTURE_RGB_EXT, True,
+        GLX_X_RENDERABLE, True,
+        GLX_RENDER_TYPE, GLX_RGBA_BIT,
+        None
+    };
+    GlctxPixmapConfig *pcfg = NULL;
+    GlctxConfigInfo *infos;
+    int n_infos;
+    int n;
+
+    for (n = 0; n < GLCTX_PIXMAP_DEPTHS; ++n)
+    {
+        if (ctx->pixmap_configs[n].depth == depth)
+            return &ctx->pixmap_configs[n];
+        if (!ctx->pixmap_configs[n].depth && !pcfg)
+            pcfg = &ctx->pixmap_configs[n];
+    }
+    if (!pcfg)
+        return NULL;
+    pcfg->depth = depth;
+    pcfg->config = NULL;
+    if (glctx_enumerate_configs(ctx, attrs, 1, &infos, &n_infos))
+        return pcfg;
+    /* Keep the implementation's order, which puts the best first */
+    for (n = 0; n < n_infos && !pcfg->config; ++n)
+    {
+        XVisualInfo *visual = glXGetVisualFromFBConfig(ctx->dpy,
+                infos[n].config);
+
+        if (visual && visual->depth == depth)
+        {
+            pcfg->config = infos[n].config;
+            pcfg->y_inverted = glctx_get_fbconfig_attrib(ctx,
+                    infos[n].config, GLX_Y_INVERTED_EXT);
+        }
+        if (visual)
+            XFree(visual);
+    }
+    glctx_free_configs(infos);
+    if (!pcfg->config)
+        glctx__log("glctx: No config to bind pixmaps of depth %d\n", depth);
+    return pcfg;
+}
+
+static GlctxPixmapBinding *glctx_find_pixmap(GlctxHandle ctx, Pixmap pixmap)
+{
+    GlctxPixmapBinding *binding;
+
+    for (binding = ctx->pixmaps; binding; binding = binding->next)
+    {
+        if (binding->pixmap == pixmap)
+            return binding;
+    }
+    return NULL;
+}
+
+static GlctxError glctx_new_pixmap_binding(GlctxHandle ctx, Pixmap pixmap,
+        GlctxPixmapBinding **pbinding)
+{
+    GlctxPixmapBinding *binding;
+    GlctxPixmapConfig *pcfg;
+    Window root;
+    int x, y;
+    unsigned int width, height, border, depth;
+    int attrs[] = {
+        GLX_TEXTURE_TARGET_EXT, GLX_TEXTURE_2D_EXT,
+        GLX_TEXTURE_FORMAT_EXT, GLX_TEXTURE_FORMAT_RGB_EXT,
+        None
+    };
+
+    if (!XGetGeometry(ctx->dpy, pixmap, &root, &x, &y,
+            &width, &height, &border, &depth))
+    {
+        glctx__log("glctx: Unable to get pixmap geometry\n");
+        return GLCTX_ERROR_SURFACE;
+    }
+    pcfg = glctx_get_pixmap_config(ctx, (int) depth);
+    if (!pcfg || !pcfg->config)
+        return GLCTX_ERROR_CONFIG;
+    if (depth == 32)
+        attrs[3] = GLX_TEXTURE_FORMAT_RGBA_EXT;
+    binding = malloc(sizeof(GlctxPixmapBinding));
+    if (!binding)
+        return GLCTX_ERROR_MEMORY;
+    binding->glx_pixmap = glXCreatePixmap(ctx->dpy, pcfg->config,
+            pixmap, attrs);
+    if (!binding->glx_pixmap)
+    {
+        glctx__log("glctx: Unable to create GLX pixmap\n");
+        free(binding);
+        return GLCTX_ERROR_SURFACE;
+    }
+    binding->pixmap = pixmap;
+    binding->y_inverted = pcfg->y_inverted;
+    binding->damaged = 0;
+    GLCTX_GL(ctx, GenTextures)(1, &binding->texture);
+    binding->next = ctx->pixmaps;
+    ctx->pixmaps = binding;
+    *pbinding = binding;
+    return GLCTX_ERROR_NONE;
+}
+
+GlctxError glctx_bind_pixmap(GlctxHandle ctx, Pixmap pixmap,
+        unsigned int *ptexture, int *py_inverted)
+{
+    glXBindTexImageEXTProc bind_tex_image;
+    glXReleaseTexImageEXTProc release_tex_image;
+    GlctxPixmapBinding *binding;
+    GlctxError result;
+    int old_texture = 0;
+    int rebind;
+
+    *ptexture = 0;
+    if (glctx_get_current() != ctx)
+        return GLCTX_ERROR_BIND;
+    binding = glctx_find_pixmap(ctx, pixmap);
+    if (binding && !binding->damaged)
+    {
+        *ptexture = binding->texture;
+        if (py_inverted)
+            *py_inverted = binding->y_inverted;
+        return GLCTX_ERROR_NONE;
+    }
+    if (!glctx_has_extension(ctx, "GLX_EXT_texture_from_pixmap"))
+        return GLCTX_ERROR_UNSUPPORTED;
+    bind_tex_image = (glXBindTexImageEXTProc)
+            glctx_get_proc_address(ctx, "glXBindTexImageEXT");
+    release_tex_image = (glXReleaseTexImageEXTProc)
+            glctx_get_proc_address(ctx, "glXReleaseTexImageEXT");
+    if (!bind_tex_image || !release_tex_image)
+        return GLCTX_ERROR_UNSUPPORTED;
+
+    rebind = binding != NULL;
+    if (!binding)
+    {
+        result = glctx_new_pixmap_binding(ctx, pixmap, &binding);
+        if (result)
+            return result;
+    }
+
+    /* Leave the caller's texture bound */
+    GLCTX_GL(ctx, GetIntegerv)(GLCTX_TEXTURE_BINDING_2D, &old_texture);
+    GLCTX_GL(ctx, BindTexture)(GLCTX_TEXTURE_2D, binding->texture);
+    if (rebind)
+    {
+        /* Rebinding is what picks up new contents */
+        release_tex_image(ctx->dpy, binding->glx_pixmap, GLX_FRONT_LEFT_EXT);
+    }
+    else
+    {
+        GLCTX_GL(ctx, TexParameteri)(GLCTX_TEXTURE_2D,
+                GLCTX_TEXTURE_MIN_FILTER, GLCTX_LINEAR);
+    }
+    bind_tex_image(ctx->dpy, binding->glx_pixmap, GLX_FRONT_LEFT_EXT, NULL);
+    GLCTX_GL(ctx, BindTexture)(GLCTX_TEXTURE_2D, (unsigned int) old_texture);
+    binding->damaged = 0;
+    *ptexture = binding->texture;
+    if (py_inverted)
+        *py_inverted = binding->y_inverted;
+    return GLCTX_ERROR_NONE;
+}
+
+void glctx_pixmap_damaged(GlctxHandle ctx, Pixmap pixmap)
+{
+    GlctxPixmapBinding *binding = glctx_find_pixmap(ctx, pixmap);
+
+    if (binding)
+        binding->damaged = 1;
+}
+
+/* Deletes the texture too if delete_texture; ctx must be current for that */
+static void glctx_free_pixmap_binding(GlctxHandle ctx,
+        GlctxPixmapBinding *binding, int delete_texture)
+{
+    /* Destroying the GLX pixmap releases it from the texture */
+    glXDestroyPixmap(ctx->dpy, binding->glx_pixmap);
+    if (delete_texture)
+        GLCTX_GL(ctx, DeleteTextures)(1, &binding->texture);
+    free(binding);
+}
+
+GlctxError glctx_release_pixmap(GlctxHandle ctx, Pixmap pixmap)
+{
+    GlctxPixmapBinding **pbinding;
+    GlctxPixmapBinding *binding;
+
+    if (glctx_get_current() != ctx)
+        return GLCTX_ERROR_BIND;
+    for (pbinding = &ctx->pixmaps; *pbinding; pbinding = &(*pbinding)->next)
+    {
+        if ((*pbinding)->pixmap == pixmap)
+            break;
+    }
+    binding = *pbinding;
+    if (!binding)
+        return GLCTX_ERROR_NONE;
+    *pbinding = binding->next;
+    glctx_free_pixmap_binding(ctx, binding, 1);
+    return GLCTX_ERROR_NONE;
+}
+
 GlctxNativeContext glctx_get_native_context(GlctxHandle ctx)
 {
     return ctx->ctx;
 }
 
-#if 0
-int glctx_get_width(GlctxHandle ctx)
+GlctxDispatch **glctx__get_dispatch(GlctxHandle ctx)
 {
-    return ctx->width;
+    return &ctx->dispatch;
 }
 
-int glctx_get_height(GlctxHandle ctx)
+GlctxProc glctx__get_native_proc(const char *name)
 {
-    return ctx->height;
+    return (GlctxProc) glXGetProcAddressARB((const GLubyte *) name);
+}
+
+int glctx__get_native_extensions(GlctxHandle ctx,
+        const char **strings, int max)
+{
+    if (max < 1)
+        return 0;
+    strings[0] = glXQueryExtensionsString(ctx->dpy, ctx->screen);
+    return strings[0] ? 1 : 0;
+}
+
+void glctx__get_display_key(GlctxHandle ctx, void **display, int *screen)
+{
+    *display = ctx->dpy;
+    *screen = ctx->screen;
 }
-#endif
 
 void glctx_flip(GlctxHandle ctx)
 {
-    glXSwapBuffers(ctx->dpy, ctx->window);
+    glXSwapBuffers(ctx->dpy, glctx_get_drawable(ctx, ctx->draw));
+}
+
+/* GLX has no damage extension */
+void glctx_flip_damage(GlctxHandle ctx, const int *rects, int n)
+{
+    (void) rects;
+    (void) n;
+    glctx_flip(ctx);
+}
+
+GlctxError glctx_set_damage_region(GlctxHandle ctx, const int *rects, int n)
+{
+    (void) ctx;
+    (void) rects;
+    (void) n;
+    return GLCTX_ERROR_UNSUPPORTED;
+}
+
+int glctx_get_buffer_age(GlctxHandle ctx)
+{
+    unsigned int age = 0;
+
+    if (!glctx_has_extension(ctx, "GLX_EXT_buffer_age"))
+        return 0;
+    glXQueryDrawable(ctx->dpy, glctx_get_drawable(ctx, ctx->draw),
+            0x20F4 /* GLX_BACK_BUFFER_AGE_EXT */, &age);
+    return (int) age;
+}
+
+typedef void (*glXSwapIntervalEXTProc)(Display *, GLXDrawable, int);
+typedef int (*glXSwapIntervalMESAProc)(unsigned int);
+typedef int (*glXSwapIntervalSGIProc)(int);
+
+GlctxError glctx_set_swap_interval(GlctxHandle ctx, int interval)
+{
+    if (interval < 0 &&
+            !glctx_has_extension(ctx, "GLX_EXT_swap_control_tear"))
+    {
+        glctx__log("glctx: Adaptive vsync not supported\n");
+        interval = 1;
+    }
+    if (glctx_has_extension(ctx, "GLX_EXT_swap_control"))
+    {
+        glXSwapIntervalEXTProc swap_interval = (glXSwapIntervalEXTProc)
+                glXGetProcAddressARB((const GLubyte *) "glXSwapIntervalEXT");
+
+        if (swap_interval)
+        {
+            swap_interval(ctx->dpy, glctx_get_drawable(ctx, ctx->draw),
+                    interval);
+            return GLCTX_ERROR_NONE;
+        }
+    }
+    if (interval < 0)
+        interval = 1;
+    if (glctx_has_extension(ctx, "GLX_MESA_swap_control"))
+    {
+        glXSwapIntervalMESAProc swap_interval = (glXSwapIntervalMESAProc)
+                glXGetProcAddressARB((const GLubyte *) "glXSwapIntervalMESA");
+
+        if (swap_interval && !swap_interval(interval))
+            return GLCTX_ERROR_NONE;
+    }
+    /* SGI can't disable vsync */
+    if (interval > 0 &&
+            glctx_has_extension(ctx, "GLX_SGI_swap_control"))
+    {
+        glXSwapIntervalSGIProc swap_interval = (glXSwapIntervalSGIProc)
+                glXGetProcAddressARB((const GLubyte *) "glXSwapIntervalSGI");
+
+        if (swap_interval && !swap_interval(interval))
+            return GLCTX_ERROR_NONE;
+    }
+    glctx__log("glctx: Unable to set swap interval %d\n", interval);
+    return GLCTX_ERROR_UNSUPPORTED;
 }
 
 GlctxError glctx_unbind(GlctxHandle ctx)
 {
+    if (glctx_get_current() != ctx)
+        return GLCTX_ERROR_NONE;
     glXMakeCurrent(ctx->dpy, None, NULL);
+    glctx__set_current(NULL);
     return GLCTX_ERROR_NONE;
 }
 
 GlctxError glctx_bind(GlctxHandle ctx)
 {
-    glXMakeCurrent(ctx->dpy, ctx->window, ctx->ctx);
-    return GLCTX_ERROR_NONE;
+    if (glctx_get_current() == ctx)
+        return GLCTX_ERROR_NONE;
+    return glctx_make_current(ctx);
 }
 
 void glctx_terminate(GlctxHandle ctx)
 {
     if (ctx->dpy)
     {
+        if (ctx->pixmaps)
+        {
+            /*
+             * Workers may keep the share group alive, so the textures have
+             * to be deleted. That needs ctx current, so the thread's
+             * previous handle is restored afterwards.
+             */
+            GlctxHandle old_ctx = glctx_get_current();
+            int bound = glctx_bind(ctx) == GLCTX_ERROR_NONE;
+
+            if (!bound)
+            {
+                glctx__log("glctx: Unable to bind handle to free pixmap "
+                        "textures\n");
+            }
+            while (ctx->pixmaps)
+            {
+                GlctxPixmapBinding *binding = ctx->pixmaps;
+
+                ctx->pixmaps = binding->next;
+                glctx_free_pixmap_binding(ctx, binding, bound);
+            }
+            glctx_unbind(ctx);
+            if (old_ctx && old_ctx != ctx)
+                glctx_bind(old_ctx);
+        }
         glctx_unbind(ctx);
         if (ctx->ctx)
         {
             glXDestroyContext(ctx->dpy, ctx->ctx);
             ctx->ctx = NULL;
         }
+        while (ctx->surfaces)
+            glctx_detach_surface(ctx, ctx->surfaces);
+        if (ctx->pbuffer)
+        {
+            glXDestroyPbuffer(ctx->dpy, ctx->pbuffer);
+            ctx->pbuffer = None;
+        }
+        if (ctx->own_dpy)
+        {
+            glctx__forget_display(ctx->dpy, ctx->screen);
+            XCloseDisplay(ctx->dpy);
+        }
     }
+    glctx__free_dispatch(ctx->dispatch);
     free(ctx);
 }
@@ -0,0 +1,434 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE     /* F_GET_SEALS */
+#endif
+
+#include "glctx-private.h"
+
+#include "EGL/egl.h"
+#include "EGL/eglext.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#define GLCTX_HAVE_DMA_BUF 1
+#else
+#define GLCTX_HAVE_DMA_BUF 0
+#endif
+
+#ifndef EGL_LINUX_DMA_BUF_EXT
+#define EGL_LINUX_DMA_BUF_EXT 0x3270
+#define EGL_LINUX_DRM_FOURCC_EXT 0x3271
+#endif
+
+#define GLCTX_TEXTURE_2D 0x0DE1
+#define GLCTX_TEXTURE_EXTERNAL_OES 0x8D65
+#define GLCTX_TEXTURE_MIN_FILTER 0x2801
+#define GLCTX_TEXTURE_MAG_FILTER 0x2800
+#define GLCTX_TEXTURE_WRAP_S 0x2802
+#define GLCTX_TEXTURE_WRAP_T 0x2803
+#define GLCTX_LINEAR 0x2601
+#define GLCTX_CLAMP_TO_EDGE 0x812F
+
+typedef void *(EGLAPIENTRY *eglCreateImageKHRProc)
+        (EGLDisplay, EGLContext, EGLenum, EGLClientBuffer, const EGLint *);
+typedef EGLBoolean (EGLAPIENTRY *eglDestroyImageKHRProc)(EGLDisplay, void *);
+
+/* From linux/udmabuf.h, which older kernel headers don't have */
+struct glctx_udmabuf_create {
+    unsigned int memfd;
+    unsigned int flags;
+    unsigned long long offset;
+    unsigned long long size;
+};
+
+#define GLCTX_UDMABUF_FLAGS_CLOEXEC 0x01
+#define GLCTX_UDMABUF_CREATE _IOW('u', 0x42, struct glctx_udmabuf_create)
+
+/* EGL_DMA_BUF_PLANEn_FD/OFFSET/PITCH/MODIFIER_LO/MODIFIER_HI_EXT */
+static const EGLint glctx_plane_attrs[GLCTX_IMAGE_MAX_PLANES][5] = {
+    { 0x3272, 0x3273, 0x3274, 0x3443, 0x3444 },
+    { 0x3275, 0x3276, 0x3277, 0x3445, 0x3446 },
+    { 0x3278, 0x3279, 0x327A, 0x3447, 0x3448 },
+    { 0x3440, 0x3441, 0x3442, 0x3449, 0x344A }
+};
+
+/*
+ * Everything that identifies an import. Planes are identified by their
+ * file, which can't be reused while an EGLImage (or for memfds, our udmabuf)
+ * holds a reference to it. Zeroed before filling so it can be memcmp'd.
+ */
+typedef struct {
+    int width, height;
+    unsigned int fourcc;
+    unsigned long long modifier;
+    int n_planes;
+    int external;
+    struct {
+        unsigned long long dev, ino;
+        unsigned int offset, pitch;
+    } planes[GLCTX_IMAGE_MAX_PLANES];
+} GlctxImageKey;
+
+typedef struct {
+    GlctxImageKey key;
+    void *image;
+    unsigned int texture;
+    int udmabufs[GLCTX_IMAGE_MAX_PLANES];   /* -1 unless made from a memfd */
+    unsigned int last_used;                 /* 0 if the entry is free */
+} GlctxImageEntry;
+
+struct GlctxImageCache_ {
+    GlctxHandle ctx;
+    GlctxImageEntry *entries;
+    int capacity;
+    unsigned int clock;
+    int udmabuf_dev;        /* /dev/udmabuf, opened when first needed */
+    int modifiers;          /* EGL_EXT_image_dma_buf_import_modifiers */
+    int external;           /* GL_OES_EGL_image_external */
+    eglCreateImageKHRProc create_image;
+    eglDestroyImageKHRProc destroy_image;
+};
+
+GlctxError glctx_image_cache_create(GlctxHandle ctx,
+        int capacity, GlctxImageCache *pcache)
+{
+#if GLCTX_HAVE_DMA_BUF
+    GlctxImageCache cache;
+
+    *pcache = NULL;
+    /* The GL extensions can only be checked with a current context */
+    if (glctx_get_current() != ctx)
+        return GLCTX_ERROR_BIND;
+    if (!glctx_has_extension(ctx, "EGL_KHR_image_base") ||
+            !glctx_has_extension(ctx, "EGL_EXT_image_dma_buf_import"))
+    {
+        glctx__log("glctx: Image import needs EGL_KHR_image_base and "
+                "EGL_EXT_image_dma_buf_import\n");
+        return GLCTX_ERROR_UNSUPPORTED;
+    }
+    if (!glctx_has_extension(ctx, "GL_OES_EGL_image") ||
+            !GLCTX_GL(ctx, EGLImageTargetTexture2DOES))
+    {
+        glctx__log("glctx: Image import needs GL_OES_EGL_image\n");
+        return GLCTX_ERROR_UNSUPPORTED;
+    }
+    cache = calloc(1, sizeof(struct GlctxImageCache_));
+    if (!cache)
+        return GLCTX_ERROR_MEMORY;
+    cache->capacity = capacity > 0 ? capacity : 1;
+    cache->entries = calloc(cache->capacity, sizeof(GlctxImageEntry));
+    if (!cache->entries)
+    {
+        free(cache);
+        return GLCTX_ERROR_MEMORY;
+    }
+    cache->ctx = ctx;
+    cache->udmabuf_dev = -1;
+    cache->modifiers = glctx_has_extension(ctx,
+            "EGL_EXT_image_dma_buf_import_modifiers");
+    cache->external = glctx_has_extension(ctx, "GL_OES_EGL_image_external");
+    cache->create_image = (eglCreateImageKHRProc)
+            glctx_get_proc_address(ctx, "eglCreateImageKHR");
+    cache->destroy_image = (eglDestroyImageKHRProc)
+            glctx_get_proc_address(ctx, "eglDestroyImageKHR");
+    if (!cache->create_image || !cache->destroy_image)
+    {
+        glctx_image_cache_destroy(cache);
+        return GLCTX_ERROR_UNSUPPORTED;
+    }
+    *pcache = cache;
+    return GLCTX_ERROR_NONE;
+#else
+    (void) ctx;
+    (void) capacity;
+    *pcache = NULL;
+    return GLCTX_ERROR_UNSUPPORTED;
+#endif
+}
+
+#if GLCTX_HAVE_DMA_BUF
+static void glctx_image_entry_free(GlctxImageCache cache,
+        GlctxImageEntry *entry)
+{
+    GlctxHandle ctx = cache->ctx;
+    int n;
+
+    if (!entry->last_used)
+        return;
+    if (entry->texture)
+        GLCTX_GL(ctx, DeleteTextures)(1, &entry->texture);
+    if (entry->image)
+        cache->destroy_image(glctx_get_egl_display(ctx), entry->image);
+    for (n = 0; n < GLCTX_IMAGE_MAX_PLANES; ++n)
+    {
+        if (entry->udmabufs[n] >= 0)
+            close(entry->udmabufs[n]);
+    }
+    memset(entry, 0, sizeof(GlctxImageEntry));
+}
+
+static int glctx_image_make_key(const GlctxImageDesc *desc,
+        GlctxImageKey *key)
+{
+    struct stat st;
+    int n;
+
+    memset(key, 0, sizeof(GlctxImageKey));
+    if (desc->n_planes < 1 || desc->n_planes > GLCTX_IMAGE_MAX_PLANES)
+        return 0;
+    key->width = desc->width;
+    key->height = desc->height;
+    key->fourcc = desc->fourcc;
+    key->modifier = desc->modifier;
+    key->n_planes = desc->n_planes;
+    key->external = desc->external != 0;
+    for (n = 0; n < desc->n_planes; ++n)
+    {
+        if (fstat(desc->planes[n].fd, &st) < 0)
+            return 0;
+        key->planes[n].dev = st.st_dev;
+        key->planes[n].ino = st.st_ino;
+        key->planes[n].offset = desc->planes[n].offset;
+        key->planes[n].pitch = desc->planes[n].pitch;
+    }
+    return 1;
+}
+
+/*
+ * Returns a dma-buf for a plane's fd: the fd itself, or a udmabuf made from
+ * it (stored in entry) if it's a memfd, or -1
+ */
+static int glctx_image_plane_fd(GlctxImageCache cache,
+        GlctxImageEntry *entry, const GlctxImageDesc *desc, int n)
+{
+    struct glctx_udmabuf_create create;
+    struct stat st;
+    int fd = desc->planes[n].fd;
+    int i;
+
+    /* Only memfds (shmem) have seals */
+    if (fcntl(fd, F_GET_SEALS) < 0)
+        return fd;
+    for (i = 0; i < n; ++i)
+    {
+        if (entry->udmabufs[i] >= 0 &&
+                entry->key.planes[i].dev == entry->key.planes[n].dev &&
+                entry->key.planes[i].ino == entry->key.planes[n].ino)
+        {
+            return entry->udmabufs[i];
+        }
+    }
+    if (cache->udmabuf_dev < 0)
+        cache->udmabuf_dev = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+    if (cache->udmabuf_dev < 0 || fstat(fd, &st) < 0)
+    {
+        glctx__log("glctx: Unable to open /dev/udmabuf for memfd import\n");
+        return -1;
+    }
+    create.memfd = fd;
+    create.flags = GLCTX_UDMABUF_FLAGS_CLOEXEC;
+    create.offset = 0;
+    create.size = st.st_size;
+    entry->udmabufs[n] = ioctl(cache->udmabuf_dev,
+            GLCTX_UDMABUF_CREATE, &create);
+    if (entry->udmabufs[n] < 0)
+    {
+        glctx__log("glctx: UDMABUF_CREATE failed, memfds must be sealed "
+                "with F_SEAL_SHRINK and a multiple of the page size\n");
+        entry->udmabufs[n] = -1;
+    }
+    return entry->udmabufs[n];
+}
+
+static GlctxError glctx_image_create(GlctxImageCache cache,
+        GlctxImageEntry *entry, const GlctxImageDesc *desc)
+{
+    GlctxHandle ctx = cache->ctx;
+    EGLint attrs[6 + GLCTX_IMAGE_MAX_PLANES * 10 + 1];
+    unsigned int target = entry->key.external ?
+            GLCTX_TEXTURE_EXTERNAL_OES : GLCTX_TEXTURE_2D;
+    int a = 0;
+    int n;
+
+    attrs[a++] = EGL_WIDTH;
+    attrs[a++] = desc->width;
+    attrs[a++] = EGL_HEIGHT;
+    attrs[a++] = desc->height;
+    attrs[a++] = EGL_LINUX_DRM_FOURCC_EXT;
+    attrs[a++] = (EGLint) desc->fourcc;
+    for (n = 0; n < desc->n_planes; ++n)
+    {
+        int fd = glctx_image_plane_fd(cache, entry, desc, n);
+
+        if (fd < 0)
+            return GLCTX_ERROR_UNSUPPORTED;
+        attrs[a++] = glctx_plane_attrs[n][0];
+        attrs[a++] = fd;
+        attrs[a++] = glctx_plane_attrs[n][1];
+        attrs[a++] = (EGLint) desc->planes[n].offset;
+        attrs[a++] = glctx_plane_attrs[n][2];
+        attrs[a++] = (EGLint) desc->planes[n].pitch;
+        if (cache->modifiers && desc->modifier != GLCTX_IMAGE_NO_MODIFIER)
+        {
+            attrs[a++] = glctx_plane_attrs[n][3];
+            attrs[a++] = (EGLint) (desc->modifier & 0xffffffffu);
+            attrs[a++] = glctx_plane_attrs[n][4];
+            attrs[a++] = (EGLint) (desc->modifier >> 32);
+        }
+    }
+    attrs[a] = EGL_NONE;
+
+    entry->image = cache->create_image(glctx_get_egl_display(ctx),
+            EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT, NULL, attrs);
+    if (!entry->image)
+    {
+        glctx__log("glctx: eglCreateImageKHR failed (0x%x)\n",
+                eglGetError());
+        return GLCTX_ERROR_UNSUPPORTED;
+    }
+    /* So an earlier error isn't blamed on the bind */
+    glctx__clear_gl_errors(ctx);
+    GLCTX_GL(ctx, GenTextures)(1, &entry->texture);
+    GLCTX_GL(ctx, BindTexture)(target, entry->texture);
+    GLCTX_GL(ctx, TexParameteri)(target,
+            GLCTX_TEXTURE_MIN_FILTER, GLCTX_LINEAR);
+    GLCTX_GL(ctx, TexParameteri)(target,
+            GLCTX_TEXTURE_MAG_FILTER, GLCTX_LINEAR);
+    GLCTX_GL(ctx, TexParameteri)(target,
+            GLCTX_TEXTURE_WRAP_S, GLCTX_CLAMP_TO_EDGE);
+    GLCTX_GL(ctx, TexParameteri)(target,
+            GLCTX_TEXTURE_WRAP_T, GLCTX_CLAMP_TO_EDGE);
+    GLCTX_GL(ctx, EGLImageTargetTexture2DOES)(target, entry->image);
+    GLCTX_GL(ctx, BindTexture)(target, 0);
+    if (GLCTX_GL(ctx, GetError)())
+    {
+        glctx__log("glctx: Unable to bind EGLImage to texture\n");
+        return GLCTX_ERROR_UNSUPPORTED;
+    }
+    return GLCTX_ERROR_NONE;
+}
+#endif
+
+GlctxError glctx_image_cache_import(GlctxImageCache cache,
+        const GlctxImageDesc *desc, unsigned int *ptexture)
+{
+#if GLCTX_HAVE_DMA_BUF
+    GlctxImageKey key;
+    GlctxImageEntry *entry = NULL;
+    GlctxError result;
+    int n;
+
+    *ptexture = 0;
+    if (glctx_get_current() != cache->ctx)
+        return GLCTX_ERROR_BIND;
+    if (!glctx_image_make_key(desc, &key))
+    {
+        glctx__log("glctx: Invalid image planes\n");
+        return GLCTX_ERROR_UNSUPPORTED;
+    }
+    if (key.external && !cache->external)
+    {
+        glctx__log("glctx: External images need "
+                "GL_OES_EGL_image_external\n");
+        return GLCTX_ERROR_UNSUPPORTED;
+    }
+    if (!++cache->clock)
+    {
+        /*
+         * 0 marks free entries, so don't use it when the clock wraps. Older
+         * entries would look newer than the ones used from now on, so
+         * forget their order instead.
+         */
+        for (n = 0; n < cache->capacity; ++n)
+        {
+            if (cache->entries[n].last_used)
+                cache->entries[n].last_used = 1;
+        }
+        cache->clock = 2;
+    }
+    for (n = 0; n < cache->capacity; ++n)
+    {
+        GlctxImageEntry *e = &cache->entries[n];
+
+        if (e->last_used && !memcmp(&e->key, &key, sizeof(key)))
+        {
+            e->last_used = cache->clock;
+            *ptexture = e->texture;
+            return GLCTX_ERROR_NONE;
+        }
+        /* Free entries have last_used 0 so they're picked first */
+        if (!entry || e->last_used < entry->last_used)
+            entry = e;
+    }
+
+    glctx_image_entry_free(cache, entry);
+    entry->key = key;
+    entry->last_used = cache->clock;
+    for (n = 0; n < GLCTX_IMAGE_MAX_PLANES; ++n)
+        entry->udmabufs[n] = -1;
+    result = glctx_image_create(cache, entry, desc);
+    if (result)
+    {
+        glctx_image_entry_free(cache, entry);
+        return result;
+    }
+    *ptexture = entry->texture;
+    return GLCTX_ERROR_NONE;
+#else
+    (void) cache;
+    (void) desc;
+    *ptexture = 0;
+    return GLCTX_ERROR_UNSUPPORTED;
+#endif
+}
+
+void glctx_image_cache_evict(GlctxImageCache cache, int fd)
+{
+#if GLCTX_HAVE_DMA_BUF
+    struct stat st;
+    int n, p;
+
+    if (fstat(fd, &st) < 0)
+        return;
+    for (n = 0; n < cache->capacity; ++n)
+    {
+        GlctxImageEntry *e = &cache->entries[n];
+
+        for (p = 0; p < e->key.n_planes; ++p)
+        {
+            if (e->key.planes[p].dev == (unsigned long long) st.st_dev &&
+                    e->key.planes[p].ino == (unsigned long long) st.st_ino)
+            {
+                glctx_image_entry_free(cache, e);
+                break;
+            }
+        }
+    }
+#else
+    (void) cache;
+    (void) fd;
+#endif
+}
+
+void glctx_image_cache_destroy(GlctxImageCache cache)
+{
+#if GLCTX_HAVE_DMA_BUF
+    int n;
+
+    if (!cache)
+        return;
+    for (n = 0; n < cache->capacity; ++n)
+        glctx_image_entry_free(cache, &cache->entries[n]);
+    if (cache->udmabuf_dev >= 0)
+        close(cache->udmabuf_dev);
+    free(cache->entries);
+    free(cache);
+#else
+    (void) cache;
+#endif
+}
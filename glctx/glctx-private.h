@@ -0,0 +1,242 @@
+#ifndef GLCTX_PRIVATE_H
+#define GLCTX_PRIVATE_H
+
+/*
+ * Declarations shared between glctx-common.c and the backends. Not
+ * installed.
+ */
+
+#include "glctx.h"
+#include "glctx-gl.h"
+
+#include <stddef.h>
+
+#if !GLCTX_MSWIN
+#include <pthread.h>
+#endif
+
+#if defined(_MSC_VER)
+#define GLCTX_INLINE __inline
+#else
+#define GLCTX_INLINE inline
+#endif
+
+/*
+ * Minimal threads, mutexes, condition variables and atomics. Loads acquire,
+ * stores release and read-modify-write operations and glctx__atomic_fence
+ * are sequentially consistent.
+ */
+#if GLCTX_MSWIN
+typedef volatile long GlctxAtomicInt;
+typedef SRWLOCK GlctxMutex;
+typedef CONDITION_VARIABLE GlctxCond;
+typedef HANDLE GlctxThread;
+#define GLCTX_MUTEX_INITIALIZER SRWLOCK_INIT
+#define glctx__mutex_init(m) InitializeSRWLock(m)
+#define glctx__mutex_destroy(m) ((void) (m))
+#define glctx__mutex_lock(m) AcquireSRWLockExclusive(m)
+#define glctx__mutex_unlock(m) ReleaseSRWLockExclusive(m)
+#define glctx__cond_init(c) InitializeConditionVariable(c)
+#define glctx__cond_destroy(c) ((void) (c))
+#define glctx__cond_wait(c, m) SleepConditionVariableSRW((c), (m), INFINITE, 0)
+#define glctx__cond_broadcast(c) WakeAllConditionVariable(c)
+#define glctx__atomic_fence() MemoryBarrier()
+
+static GLCTX_INLINE void *glctx__atomic_load_ptr(void *volatile *p)
+{
+    return InterlockedCompareExchangePointer(p, NULL, NULL);
+}
+
+static GLCTX_INLINE void glctx__atomic_store_ptr(void *volatile *p, void *v)
+{
+    InterlockedExchangePointer(p, v);
+}
+
+static GLCTX_INLINE int glctx__atomic_cas_ptr(void *volatile *p,
+        void *expected, void *desired)
+{
+    return InterlockedCompareExchangePointer(p, desired, expected) ==
+            expected;
+}
+
+static GLCTX_INLINE int glctx__atomic_load_int(GlctxAtomicInt *p)
+{
+    return InterlockedCompareExchange(p, 0, 0);
+}
+
+static GLCTX_INLINE void glctx__atomic_store_int(GlctxAtomicInt *p, int v)
+{
+    InterlockedExchange(p, v);
+}
+
+/* Returns the new value */
+static GLCTX_INLINE int glctx__atomic_add_int(GlctxAtomicInt *p, int v)
+{
+    return InterlockedExchangeAdd(p, v) + v;
+}
+
+static GLCTX_INLINE int glctx__atomic_cas_int(GlctxAtomicInt *p,
+        int expected, int desired)
+{
+    return InterlockedCompareExchange(p, desired, expected) == expected;
+}
+#else
+typedef volatile int GlctxAtomicInt;
+typedef pthread_mutex_t GlctxMutex;
+typedef pthread_cond_t GlctxCond;
+typedef pthread_t GlctxThread;
+#define GLCTX_MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+#define glctx__mutex_init(m) pthread_mutex_init((m), NULL)
+#define glctx__mutex_destroy(m) pthread_mutex_destroy(m)
+#define glctx__mutex_lock(m) pthread_mutex_lock(m)
+#define glctx__mutex_unlock(m) pthread_mutex_unlock(m)
+#define glctx__cond_init(c) pthread_cond_init((c), NULL)
+#define glctx__cond_destroy(c) pthread_cond_destroy(c)
+#define glctx__cond_wait(c, m) pthread_cond_wait((c), (m))
+#define glctx__cond_broadcast(c) pthread_cond_broadcast(c)
+#define glctx__atomic_fence() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+static GLCTX_INLINE void *glctx__atomic_load_ptr(void *volatile *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static GLCTX_INLINE void glctx__atomic_store_ptr(void *volatile *p, void *v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+static GLCTX_INLINE int glctx__atomic_cas_ptr(void *volatile *p,
+        void *expected, void *desired)
+{
+    return __atomic_compare_exchange_n(p, &expected, desired, 0,
+            __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static GLCTX_INLINE int glctx__atomic_load_int(GlctxAtomicInt *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static GLCTX_INLINE void glctx__atomic_store_int(GlctxAtomicInt *p, int v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+/* Returns the new value */
+static GLCTX_INLINE int glctx__atomic_add_int(GlctxAtomicInt *p, int v)
+{
+    return __atomic_add_fetch(p, v, __ATOMIC_SEQ_CST);
+}
+
+static GLCTX_INLINE int glctx__atomic_cas_int(GlctxAtomicInt *p,
+        int expected, int desired)
+{
+    return __atomic_compare_exchange_n(p, &expected, desired, 0,
+            __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+#endif
+
+/*
+ * GlctxSizeCache
+ * Last known size of a surface. Backends embed one per surface and set it
+ * when the surface is created; glctx_notify_resize updates it or marks it
+ * stale so glctx_get_width/height ask the backend again.
+ */
+typedef struct {
+    GlctxAtomicInt width, height;
+    GlctxAtomicInt stale;
+} GlctxSizeCache;
+
+/* Implemented in glctx-common.c */
+
+extern int (*glctx__log)(const char *format, ...);
+extern int glctx__log_ignore(const char *format, ...);
+extern int *glctx__make_attrs_buffer(const int *attrs,
+        const int *native_attrs, int native_attr_term);
+extern int glctx__supports_extension(const char *extensions, const char *ext);
+extern void glctx__set_current(GlctxHandle ctx);
+extern int glctx__check_context_flags(int flags);
+
+/*
+ * GlctxDispatch
+ * Per-handle cache of resolved GL functions. Backends keep a pointer to one
+ * (initially NULL) in their handle, return its address from
+ * glctx__get_dispatch, and free it with glctx__free_dispatch.
+ */
+typedef struct GlctxDispatch_ GlctxDispatch;
+
+extern void glctx__free_dispatch(GlctxDispatch *dispatch);
+
+extern void glctx__set_size(GlctxSizeCache *size, int width, int height);
+
+/* Runs func(arg) on a new thread */
+extern GlctxError glctx__thread_start(GlctxThread *thread,
+        void (*func)(void *arg), void *arg);
+extern void glctx__thread_join(GlctxThread thread);
+
+/* Monotonic time in microseconds */
+extern double glctx__now_us(void);
+
+/*
+ * Forget cached per-display state (see glctx__get_display_key) before
+ * closing a display that glcontext opened, in case the address is reused.
+ */
+extern void glctx__forget_display(void *display, int screen);
+
+/* Lazily resolves an internal GL function, see glctx-gl.h */
+extern GlctxProc glctx__gl_proc(GlctxHandle ctx, GlctxGLProcId id);
+
+/*
+ * Returns non-zero if the current context's version is at least
+ * gl_major.gl_minor for OpenGL or es_major.es_minor for OpenGL ES
+ */
+extern int glctx__check_gl_version(GlctxHandle ctx, int gl_major,
+        int gl_minor, int es_major, int es_minor);
+
+/* Discards pending glGetError flags. The context must be current. */
+extern void glctx__clear_gl_errors(GlctxHandle ctx);
+
+/* Implemented by each backend */
+
+extern void glctx__describe_driver(GlctxHandle ctx, char *buf, size_t size);
+extern void glctx__get_config_info(GlctxHandle ctx, GlctxConfig config,
+        GlctxConfigInfo *info);
+extern GlctxDispatch **glctx__get_dispatch(GlctxHandle ctx);
+extern GlctxProc glctx__get_native_proc(const char *name);
+
+/*
+ * Window system fences, preferred over GL sync objects if available.
+ * glctx__native_fence_insert returns NULL if they aren't. Waits return
+ * GLCTX_ERROR_TIMEOUT if timeout_ns (< 0 means forever) expires; a gpu wait
+ * may fall back to waiting on the CPU.
+ */
+extern void *glctx__native_fence_insert(GlctxHandle ctx);
+extern GlctxError glctx__native_fence_wait(GlctxHandle ctx, void *sync,
+        int gpu, long long timeout_ns);
+extern void glctx__native_fence_destroy(GlctxHandle ctx, void *sync);
+
+/* The size cache of the handle's current draw surface */
+extern GlctxSizeCache *glctx__get_size_cache(GlctxHandle ctx);
+
+/*
+ * Queries the size of the draw surface from the window system. Returns 0 if
+ * it can't or the size can't change (eg pbuffers).
+ */
+extern int glctx__query_size(GlctxHandle ctx, int *width, int *height);
+
+/*
+ * Identifies the display (and screen) whose window system extensions the
+ * handle uses, so they can be shared by all handles on it
+ */
+extern void glctx__get_display_key(GlctxHandle ctx,
+        void **display, int *screen);
+
+/*
+ * Fills strings with up to max space-separated lists of window system
+ * extensions and returns how many, or -1 if they can't be queried yet
+ */
+extern int glctx__get_native_extensions(GlctxHandle ctx,
+        const char **strings, int max);
+
+#endif /* GLCTX_PRIVATE_H */
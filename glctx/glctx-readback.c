@@ -0,0 +1,186 @@
+#include "glctx-private.h"
+
+#include <stdlib.h>
+
+#define GLCTX_PIXEL_PACK_BUFFER 0x88EB
+#define GLCTX_STREAM_READ 0x88E1
+#define GLCTX_MAP_READ_BIT 0x0001
+#define GLCTX_RGBA 0x1908
+#define GLCTX_UNSIGNED_BYTE 0x1401
+
+/*
+ * Slots are filled at head and delivered from tail, in capture order. A
+ * slot is pending while it has a fence.
+ */
+
+typedef struct {
+    unsigned int buffer;
+    GlctxFence fence;
+    unsigned int frame;
+    double time;
+} GlctxReadbackSlot;
+
+struct GlctxReadback_ {
+    GlctxHandle ctx;
+    int width, height;
+    int depth;
+    GlctxReadbackFunc func;
+    void *data;
+    GlctxReadbackSlot *slots;
+    int head, tail;
+    int pending;
+    unsigned int frame;
+};
+
+static int glctx_readback_size(GlctxReadback rb)
+{
+    return rb->width * rb->height * 4;
+}
+
+GlctxError glctx_readback_create(GlctxHandle ctx,
+        int width, int height, int depth,
+        GlctxReadbackFunc func, void *data, GlctxReadback *prb)
+{
+    GlctxReadback rb;
+    int i;
+
+    *prb = NULL;
+    if (glctx_get_current() != ctx)
+        return GLCTX_ERROR_BIND;
+    if (!glctx__check_gl_version(ctx, 3, 0, 3, 0) ||
+            !GLCTX_GL(ctx, MapBufferRange))
+    {
+        glctx__log("glctx: Readback needs OpenGL 3.0 or OpenGL ES 3.0\n");
+        return GLCTX_ERROR_UNSUPPORTED;
+    }
+    rb = calloc(1, sizeof(struct GlctxReadback_));
+    if (!rb)
+        return GLCTX_ERROR_MEMORY;
+    rb->depth = depth < 2 ? 2 : depth;
+    rb->slots = calloc(rb->depth, sizeof(GlctxReadbackSlot));
+    if (!rb->slots)
+    {
+        free(rb);
+        return GLCTX_ERROR_MEMORY;
+    }
+    rb->ctx = ctx;
+    rb->width = width > 0 ? width : 1;
+    rb->height = height > 0 ? height : 1;
+    rb->func = func;
+    rb->data = data;
+    /* So an earlier error isn't mistaken for running out of memory */
+    glctx__clear_gl_errors(ctx);
+    for (i = 0; i < rb->depth; ++i)
+    {
+        GLCTX_GL(ctx, GenBuffers)(1, &rb->slots[i].buffer);
+        GLCTX_GL(ctx, BindBuffer)(GLCTX_PIXEL_PACK_BUFFER,
+                rb->slots[i].buffer);
+        GLCTX_GL(ctx, BufferData)(GLCTX_PIXEL_PACK_BUFFER,
+                glctx_readback_size(rb), NULL, GLCTX_STREAM_READ);
+    }
+    GLCTX_GL(ctx, BindBuffer)(GLCTX_PIXEL_PACK_BUFFER, 0);
+    if (GLCTX_GL(ctx, GetError)())
+    {
+        glctx__log("glctx: Unable to create readback buffers\n");
+        glctx_readback_destroy(rb);
+        return GLCTX_ERROR_MEMORY;
+    }
+    *prb = rb;
+    return GLCTX_ERROR_NONE;
+}
+
+/* Delivers the oldest pending frame, which must be ready */
+static void glctx_readback_deliver(GlctxReadback rb)
+{
+    GlctxHandle ctx = rb->ctx;
+    GlctxReadbackSlot *slot = &rb->slots[rb->tail];
+    GlctxReadbackFrame frame;
+
+    glctx_fence_destroy(ctx, slot->fence);
+    slot->fence = NULL;
+    rb->tail = (rb->tail + 1) % rb->depth;
+    --rb->pending;
+
+    GLCTX_GL(ctx, BindBuffer)(GLCTX_PIXEL_PACK_BUFFER, slot->buffer);
+    frame.pixels = GLCTX_GL(ctx, MapBufferRange)(GLCTX_PIXEL_PACK_BUFFER,
+            0, glctx_readback_size(rb), GLCTX_MAP_READ_BIT);
+    if (frame.pixels)
+    {
+        frame.width = rb->width;
+        frame.height = rb->height;
+        frame.stride = rb->width * 4;
+        frame.frame = slot->frame;
+        frame.latency_us = glctx__now_us() - slot->time;
+        rb->func(&frame, rb->data);
+        GLCTX_GL(ctx, UnmapBuffer)(GLCTX_PIXEL_PACK_BUFFER);
+    }
+    else
+    {
+        glctx__log("glctx: Unable to map readback buffer\n");
+    }
+    GLCTX_GL(ctx, BindBuffer)(GLCTX_PIXEL_PACK_BUFFER, 0);
+}
+
+GlctxError glctx_readback_capture(GlctxReadback rb)
+{
+    GlctxHandle ctx = rb->ctx;
+    GlctxReadbackSlot *slot;
+    GlctxError result;
+
+    if (rb->pending == rb->depth)
+    {
+        glctx_fence_wait(ctx, rb->slots[rb->tail].fence, 0, -1);
+        glctx_readback_deliver(rb);
+    }
+    slot = &rb->slots[rb->head];
+    GLCTX_GL(ctx, BindBuffer)(GLCTX_PIXEL_PACK_BUFFER, slot->buffer);
+    GLCTX_GL(ctx, ReadPixels)(0, 0, rb->width, rb->height,
+            GLCTX_RGBA, GLCTX_UNSIGNED_BYTE, NULL);
+    GLCTX_GL(ctx, BindBuffer)(GLCTX_PIXEL_PACK_BUFFER, 0);
+    result = glctx_fence_insert(ctx, &slot->fence);
+    if (result)
+        return result;
+    slot->frame = rb->frame++;
+    slot->time = glctx__now_us();
+    rb->head = (rb->head + 1) % rb->depth;
+    ++rb->pending;
+    return GLCTX_ERROR_NONE;
+}
+
+int glctx_readback_poll(GlctxReadback rb)
+{
+    int n = 0;
+
+    while (rb->pending &&
+            glctx_fence_poll(rb->ctx, rb->slots[rb->tail].fence))
+    {
+        glctx_readback_deliver(rb);
+        ++n;
+    }
+    return n;
+}
+
+void glctx_readback_flush(GlctxReadback rb)
+{
+    while (rb->pending)
+    {
+        glctx_fence_wait(rb->ctx, rb->slots[rb->tail].fence, 0, -1);
+        glctx_readback_deliver(rb);
+    }
+}
+
+void glctx_readback_destroy(GlctxReadback rb)
+{
+    int i;
+
+    if (!rb)
+        return;
+    for (i = 0; i < rb->depth; ++i)
+    {
+        glctx_fence_destroy(rb->ctx, rb->slots[i].fence);
+        if (rb->slots[i].buffer)
+            GLCTX_GL(rb->ctx, DeleteBuffers)(1, &rb->slots[i].buffer);
+    }
+    free(rb->slots);
+    free(rb);
+}
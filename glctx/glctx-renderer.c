@@ -0,0 +1,258 @@
+#include "glctx-private.h"
+
+#include <stdlib.h>
+
+/*
+ * The queue is a bounded MPSC ring. Each slot's sequence number says whose
+ * turn it is: a producer may claim slot pos & mask when seq == pos, and the
+ * render thread may take it when seq == pos + 1. Positions and tokens wrap,
+ * so they're only compared by signed difference.
+ *
+ * The render thread sleeps when the queue is empty, and submitters only take
+ * the lock to wake it if it has said it's sleeping. Completion waiters work
+ * the same way in the other direction.
+ */
+
+typedef struct {
+    GlctxAtomicInt seq;
+    GlctxRenderFunc func;
+    void *data;
+} GlctxRenderItem;
+
+struct GlctxRenderer_ {
+    GlctxHandle ctx;
+    GlctxThread thread;
+    GlctxRenderItem *items;
+    unsigned int mask;
+    GlctxAtomicInt enqueue_pos;
+    unsigned int dequeue_pos;   /* Only used by the render thread */
+    GlctxAtomicInt completed;
+    GlctxAtomicInt sleeping;
+    GlctxAtomicInt waiters;
+    GlctxAtomicInt stopping;
+    GlctxMutex lock;
+    GlctxCond work_cond;
+    GlctxCond done_cond;
+    int started;
+    GlctxError bind_result;
+};
+
+static int glctx_pos_diff(int a, int b)
+{
+    return (int) ((unsigned int) a - (unsigned int) b);
+}
+
+static int glctx_renderer_has_work(GlctxRenderer renderer)
+{
+    GlctxRenderItem *slot =
+            &renderer->items[renderer->dequeue_pos & renderer->mask];
+
+    return glctx_pos_diff(glctx__atomic_load_int(&slot->seq),
+            (int) (renderer->dequeue_pos + 1)) == 0;
+}
+
+static int glctx_renderer_pop(GlctxRenderer renderer, GlctxRenderItem *item)
+{
+    GlctxRenderItem *slot =
+            &renderer->items[renderer->dequeue_pos & renderer->mask];
+
+    if (!glctx_renderer_has_work(renderer))
+        return 0;
+    item->func = slot->func;
+    item->data = slot->data;
+    glctx__atomic_store_int(&slot->seq,
+            (int) (renderer->dequeue_pos + renderer->mask + 1));
+    ++renderer->dequeue_pos;
+    return 1;
+}
+
+static void glctx_renderer_main(void *arg)
+{
+    GlctxRenderer renderer = arg;
+    GlctxRenderItem item;
+
+    glctx__mutex_lock(&renderer->lock);
+    renderer->bind_result = glctx_bind(renderer->ctx);
+    renderer->started = 1;
+    glctx__cond_broadcast(&renderer->done_cond);
+    glctx__mutex_unlock(&renderer->lock);
+    if (renderer->bind_result)
+        return;
+
+    for (;;)
+    {
+        if (glctx_renderer_pop(renderer, &item))
+        {
+            item.func(renderer->ctx, item.data);
+            glctx__atomic_add_int(&renderer->completed, 1);
+            glctx__atomic_fence();
+            if (glctx__atomic_load_int(&renderer->waiters))
+            {
+                glctx__mutex_lock(&renderer->lock);
+                glctx__cond_broadcast(&renderer->done_cond);
+                glctx__mutex_unlock(&renderer->lock);
+            }
+            continue;
+        }
+        if (glctx__atomic_load_int(&renderer->stopping))
+            break;
+        glctx__mutex_lock(&renderer->lock);
+        glctx__atomic_store_int(&renderer->sleeping, 1);
+        glctx__atomic_fence();
+        if (!glctx_renderer_has_work(renderer) &&
+                !glctx__atomic_load_int(&renderer->stopping))
+        {
+            glctx__cond_wait(&renderer->work_cond, &renderer->lock);
+        }
+        glctx__atomic_store_int(&renderer->sleeping, 0);
+        glctx__mutex_unlock(&renderer->lock);
+    }
+    glctx_unbind(renderer->ctx);
+}
+
+static void glctx_renderer_free(GlctxRenderer renderer)
+{
+    glctx__cond_destroy(&renderer->done_cond);
+    glctx__cond_destroy(&renderer->work_cond);
+    glctx__mutex_destroy(&renderer->lock);
+    free(renderer->items);
+    free(renderer);
+}
+
+GlctxError glctx_renderer_start(GlctxHandle ctx,
+        int queue_size, GlctxRenderer *prenderer)
+{
+    GlctxRenderer renderer;
+    GlctxError result;
+    unsigned int size = 1;
+    unsigned int i;
+
+    *prenderer = NULL;
+    while (size < (unsigned int) queue_size && size < 0x40000000)
+        size <<= 1;
+    renderer = calloc(1, sizeof(struct GlctxRenderer_));
+    if (!renderer)
+        return GLCTX_ERROR_MEMORY;
+    renderer->items = calloc(size, sizeof(GlctxRenderItem));
+    if (!renderer->items)
+    {
+        free(renderer);
+        return GLCTX_ERROR_MEMORY;
+    }
+    for (i = 0; i < size; ++i)
+        renderer->items[i].seq = (int) i;
+    renderer->ctx = ctx;
+    renderer->mask = size - 1;
+    glctx__mutex_init(&renderer->lock);
+    glctx__cond_init(&renderer->work_cond);
+    glctx__cond_init(&renderer->done_cond);
+
+    result = glctx__thread_start(&renderer->thread,
+            glctx_renderer_main, renderer);
+    if (result)
+    {
+        glctx_renderer_free(renderer);
+        return result;
+    }
+    glctx__mutex_lock(&renderer->lock);
+    while (!renderer->started)
+        glctx__cond_wait(&renderer->done_cond, &renderer->lock);
+    glctx__mutex_unlock(&renderer->lock);
+    result = renderer->bind_result;
+    if (result)
+    {
+        glctx__log("glctx: Unable to bind handle to render thread\n");
+        glctx__thread_join(renderer->thread);
+        glctx_renderer_free(renderer);
+        return result;
+    }
+    glctx__log("glctx: Started render thread with queue of %u\n", size);
+    *prenderer = renderer;
+    return GLCTX_ERROR_NONE;
+}
+
+GlctxError glctx_renderer_submit(GlctxRenderer renderer,
+        GlctxRenderFunc func, void *data, GlctxToken *ptoken)
+{
+    int pos = glctx__atomic_load_int(&renderer->enqueue_pos);
+    GlctxRenderItem *slot;
+
+    for (;;)
+    {
+        int diff;
+
+        slot = &renderer->items[(unsigned int) pos & renderer->mask];
+        diff = glctx_pos_diff(glctx__atomic_load_int(&slot->seq), pos);
+        if (diff == 0)
+        {
+            if (glctx__atomic_cas_int(&renderer->enqueue_pos,
+                    pos, (int) ((unsigned int) pos + 1)))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            return GLCTX_ERROR_BUSY;
+        }
+        pos = glctx__atomic_load_int(&renderer->enqueue_pos);
+    }
+    slot->func = func;
+    slot->data = data;
+    glctx__atomic_store_int(&slot->seq, (int) ((unsigned int) pos + 1));
+    if (ptoken)
+        *ptoken = (unsigned int) pos + 1;
+
+    glctx__atomic_fence();
+    if (glctx__atomic_load_int(&renderer->sleeping))
+    {
+        glctx__mutex_lock(&renderer->lock);
+        glctx__cond_broadcast(&renderer->work_cond);
+        glctx__mutex_unlock(&renderer->lock);
+    }
+    return GLCTX_ERROR_NONE;
+}
+
+static void glctx_renderer_do_flip(GlctxHandle ctx, void *data)
+{
+    (void) data;
+    glctx_flip(ctx);
+}
+
+GlctxError glctx_renderer_flip(GlctxRenderer renderer, GlctxToken *ptoken)
+{
+    return glctx_renderer_submit(renderer,
+            glctx_renderer_do_flip, NULL, ptoken);
+}
+
+int glctx_renderer_is_complete(GlctxRenderer renderer, GlctxToken token)
+{
+    return glctx_pos_diff(glctx__atomic_load_int(&renderer->completed),
+            (int) token) >= 0;
+}
+
+void glctx_renderer_wait(GlctxRenderer renderer, GlctxToken token)
+{
+    if (glctx_renderer_is_complete(renderer, token))
+        return;
+    glctx__mutex_lock(&renderer->lock);
+    glctx__atomic_add_int(&renderer->waiters, 1);
+    glctx__atomic_fence();
+    while (!glctx_renderer_is_complete(renderer, token))
+        glctx__cond_wait(&renderer->done_cond, &renderer->lock);
+    glctx__atomic_add_int(&renderer->waiters, -1);
+    glctx__mutex_unlock(&renderer->lock);
+}
+
+void glctx_renderer_stop(GlctxRenderer renderer)
+{
+    if (!renderer)
+        return;
+    glctx__atomic_store_int(&renderer->stopping, 1);
+    glctx__atomic_fence();
+    glctx__mutex_lock(&renderer->lock);
+    glctx__cond_broadcast(&renderer->work_cond);
+    glctx__mutex_unlock(&renderer->lock);
+    glctx__thread_join(renderer->thread);
+    glctx_renderer_free(renderer);
+}
@@ -1,13 +1,9 @@
-#include "glctx.h"
+#include "glctx-private.h"
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-extern int (*glctx__log)(const char *format, ...);
-extern int glctx__log_ignore(const char *format, ...);
-extern int *glctx__make_attrs_buffer(const int *attrs,
-        const int *native_attrs, int native_attr_term);
-
 static int glctx__profile_table[] = {
     0x0004,
     0x0001,
@@ -15,12 +11,32 @@ static int glctx__profile_table[] = {
     0x0002
 };
 
+struct GlctxSurfaceData_ {
+    HDC dc;
+    HWND window;
+    HANDLE pbuffer;
+    GlctxSizeCache size;
+    struct GlctxSurfaceData_ *next;
+};
+
+typedef HGLRC (__stdcall *wglCreateContextAttribsARBProc)
+        (HDC, HGLRC, const int *);
+
 struct GlctxData_ {
     HDC dpy;
     HWND window;
+    GlctxSizeCache size;
+    GlctxSurface surfaces;
+    GlctxSurface draw, read;
     GlctxProfile profile;
     int maj_version, min_version;
 	HGLRC ctx;
+    int flags;
+    GlctxDispatch *dispatch;
+    /* Resolved by glctx_activate while a context is current, so workers
+     * can be created on threads with nothing current */
+    wglCreateContextAttribsARBProc create_context_attribs;
+    int context_attrs[15];
 };
 
 GlctxError glctx_init(GlctxDisplay display, GlctxWindow window,
@@ -34,62 +50,37 @@ GlctxError glctx_init(GlctxDisplay display, GlctxWindow window,
         return GLCTX_ERROR_MEMORY;
     ctx->dpy = display;
     ctx->window = window;
+    glctx__set_size(&ctx->size, 0, 0);
+    ctx->surfaces = ctx->draw = ctx->read = NULL;
     ctx->profile = profile;
     ctx->maj_version = maj_version;
     ctx->min_version = min_version;
+    ctx->ctx = NULL;
+    ctx->flags = 0;
+    ctx->dispatch = NULL;
+    ctx->create_context_attribs = NULL;
     *pctx = ctx;
     return GLCTX_ERROR_NONE;
 }
 
+GlctxError glctx_init_headless(GlctxProfile profile,
+        int maj_version, int min_version, int width, int height,
+        GlctxHandle *pctx)
+{
+    (void) profile;
+    (void) maj_version;
+    (void) min_version;
+    (void) width;
+    (void) height;
+    *pctx = NULL;
+    glctx__log("glctx: Headless contexts are not supported with WGL\n");
+    return GLCTX_ERROR_DISPLAY;
+}
+
 GlctxError glctx_get_config(GlctxHandle ctx, GlctxConfig *cfg_out,
         const int *attrs, int native_attrs)
 {
-	PIXELFORMATDESCRIPTOR pfd;
-	int color_bits = 0;
-
-	memset(&pfd, 0, sizeof(PIXELFORMATDESCRIPTOR));
-	pfd.nSize = sizeof(PIXELFORMATDESCRIPTOR);
-	pfd.nVersion = 1;
-	pfd.dwFlags = PFD_DOUBLEBUFFER | PFD_SUPPORT_OPENGL | PFD_DRAW_TO_WINDOW;
-	pfd.iPixelType = PFD_TYPE_RGBA;
-	pfd.iLayerType = PFD_MAIN_PLANE;
-
-	if (attrs)
-	{
-		int n;
-
-		for (n = 0; attrs[n]; n += 2)
-		{
-			switch (attrs[n])
-			{
-			case GLCTX_CFG_RED_SIZE:
-			case GLCTX_CFG_GREEN_SIZE:
-			case GLCTX_CFG_BLUE_SIZE:
-			case GLCTX_CFG_ALPHA_SIZE:
-				color_bits += attrs[n + 1];
-				break;
-			case GLCTX_CFG_DEPTH_SIZE:
-				pfd.cDepthBits = attrs[n + 1];
-				break;
-			case GLCTX_CFG_STENCIL_SIZE:
-				pfd.cStencilBits = attrs[n + 1];
-				break;
-			default:
-				break;
-			}
-		}
-	}
-
-	if (color_bits >= 15 && color_bits < 24)
-		pfd.cColorBits = 16;
-	else
-		pfd.cColorBits = 32;
-
-	*cfg_out = ChoosePixelFormat(ctx->dpy, &pfd);
-	if (!*cfg_out)
-		return GLCTX_ERROR_CONFIG;
-
-    return GLCTX_ERROR_NONE;
+    return glctx_choose_config(ctx, cfg_out, attrs, native_attrs, 0, NULL);
 }
 
 int glctx_query_config(GlctxHandle ctx, GlctxConfig config, GlctxAttr attr)
@@ -125,8 +116,321 @@ int glctx_query_config(GlctxHandle ctx, GlctxConfig config, GlctxAttr attr)
     return -1;
 }
 
-typedef HGLRC (__stdcall *wglCreateContextAttribsARBProc)
-        (HDC, HGLRC, const int *);
+typedef BOOL (__stdcall *wglGetPixelFormatAttribivARBProc)
+        (HDC, int, int, UINT, const int *, int *);
+
+/* wglGetProcAddress needs a current context, though any context will do */
+static wglGetPixelFormatAttribivARBProc glctx_get_format_attribs_proc(void)
+{
+	if (!wglGetCurrentContext())
+		return NULL;
+	return (wglGetPixelFormatAttribivARBProc)
+			wglGetProcAddress("wglGetPixelFormatAttribivARB");
+}
+
+/* Returns 0 if the attribute isn't supported, eg without WGL_ARB_multisample */
+static int glctx_get_format_attrib(GlctxHandle ctx,
+		wglGetPixelFormatAttribivARBProc get_attribs, int format, int attr)
+{
+	int val = 0;
+
+	if (!get_attribs(ctx->dpy, format, 0, 1, &attr, &val))
+		return 0;
+	return val;
+}
+
+/*
+ * Fills info for format and returns non-zero if it's a window-capable RGBA
+ * OpenGL format. With WGL_ARB_pixel_format (get_attribs) this includes
+ * multisampled and sRGB formats; legacy descriptors don't describe either.
+ */
+static int glctx_describe_format(GlctxHandle ctx,
+		wglGetPixelFormatAttribivARBProc get_attribs, int format,
+		GlctxConfigInfo *info, int *generic)
+{
+	PIXELFORMATDESCRIPTOR pfd;
+
+	memset(info, 0, sizeof(GlctxConfigInfo));
+	info->config = format;
+	info->id = format;
+	*generic = 0;
+	if (get_attribs)
+	{
+		info->red_size = glctx_get_format_attrib(ctx, get_attribs, format,
+				0x2015);	/* WGL_RED_BITS_ARB */
+		info->green_size = glctx_get_format_attrib(ctx, get_attribs, format,
+				0x2017);	/* WGL_GREEN_BITS_ARB */
+		info->blue_size = glctx_get_format_attrib(ctx, get_attribs, format,
+				0x2019);	/* WGL_BLUE_BITS_ARB */
+		info->alpha_size = glctx_get_format_attrib(ctx, get_attribs, format,
+				0x201B);	/* WGL_ALPHA_BITS_ARB */
+		info->depth_size = glctx_get_format_attrib(ctx, get_attribs, format,
+				0x2022);	/* WGL_DEPTH_BITS_ARB */
+		info->stencil_size = glctx_get_format_attrib(ctx, get_attribs,
+				format, 0x2023);	/* WGL_STENCIL_BITS_ARB */
+		/* WGL_SAMPLE_BUFFERS_ARB, WGL_SAMPLES_ARB */
+		if (glctx_get_format_attrib(ctx, get_attribs, format, 0x2041))
+		{
+			info->samples = glctx_get_format_attrib(ctx, get_attribs,
+					format, 0x2042);
+		}
+		/* WGL_FRAMEBUFFER_SRGB_CAPABLE_ARB, same value for the EXT */
+		info->srgb = glctx_get_format_attrib(ctx, get_attribs, format,
+				0x20A9);
+		info->double_buffer = glctx_get_format_attrib(ctx, get_attribs,
+				format, 0x2011);	/* WGL_DOUBLE_BUFFER_ARB */
+		/* WGL_ACCELERATION_ARB == WGL_NO_ACCELERATION_ARB */
+		*generic = glctx_get_format_attrib(ctx, get_attribs, format,
+				0x2003) == 0x2025;
+		/* WGL_DRAW_TO_WINDOW_ARB, WGL_SUPPORT_OPENGL_ARB, WGL_PIXEL_TYPE_ARB */
+		return glctx_get_format_attrib(ctx, get_attribs, format, 0x2001) &&
+				glctx_get_format_attrib(ctx, get_attribs, format, 0x2010) &&
+				glctx_get_format_attrib(ctx, get_attribs, format, 0x2013) ==
+				0x202B;	/* WGL_TYPE_RGBA_ARB */
+	}
+
+	if (!DescribePixelFormat(ctx->dpy, format,
+			sizeof(PIXELFORMATDESCRIPTOR), &pfd))
+	{
+		return 0;
+	}
+	info->red_size = pfd.cRedBits;
+	info->green_size = pfd.cGreenBits;
+	info->blue_size = pfd.cBlueBits;
+	info->alpha_size = pfd.cAlphaBits;
+	info->depth_size = pfd.cDepthBits;
+	info->stencil_size = pfd.cStencilBits;
+	info->double_buffer = (pfd.dwFlags & PFD_DOUBLEBUFFER) != 0;
+	*generic = (pfd.dwFlags & PFD_GENERIC_FORMAT) &&
+			!(pfd.dwFlags & PFD_GENERIC_ACCELERATED);
+	return (pfd.dwFlags & (PFD_SUPPORT_OPENGL | PFD_DRAW_TO_WINDOW)) ==
+			(PFD_SUPPORT_OPENGL | PFD_DRAW_TO_WINDOW) &&
+			pfd.iPixelType == PFD_TYPE_RGBA;
+}
+
+void glctx__get_config_info(GlctxHandle ctx, GlctxConfig config,
+		GlctxConfigInfo *info)
+{
+	int generic;
+
+	glctx_describe_format(ctx, glctx_get_format_attribs_proc(), config,
+			info, &generic);
+}
+
+GlctxError glctx_enumerate_configs(GlctxHandle ctx,
+        const int *attrs, int native_attrs,
+        GlctxConfigInfo **pinfos, int *pcount)
+{
+	wglGetPixelFormatAttribivARBProc get_attribs =
+			glctx_get_format_attribs_proc();
+	GlctxConfigInfo *infos;
+	int n_formats;
+	int min_sizes[GLCTX_CFG_STENCIL_SIZE + 1];
+	int count = 0;
+	int pass;
+	int n;
+
+	(void) native_attrs;
+	*pinfos = NULL;
+	*pcount = 0;
+	memset(min_sizes, 0, sizeof(min_sizes));
+	if (attrs)
+	{
+		for (n = 0; attrs[n]; n += 2)
+		{
+			if (attrs[n] > 0 && attrs[n] <= GLCTX_CFG_STENCIL_SIZE)
+				min_sizes[attrs[n]] = attrs[n + 1];
+		}
+	}
+
+	/* The ARB count includes ICD formats that the legacy count may not */
+	n_formats = get_attribs ?
+			glctx_get_format_attrib(ctx, get_attribs, 1, 0x2000) : 0;
+	if (n_formats < 1)
+	{
+		get_attribs = NULL;
+		n_formats = DescribePixelFormat(ctx->dpy, 1,
+				sizeof(PIXELFORMATDESCRIPTOR), NULL);
+	}
+	if (n_formats < 1)
+		return GLCTX_ERROR_CONFIG;
+	infos = (GlctxConfigInfo *) malloc(sizeof(GlctxConfigInfo) * n_formats);
+	if (!infos)
+		return GLCTX_ERROR_MEMORY;
+
+	/* Only fall back to Microsoft's software formats if there's no ICD */
+	for (pass = 0; pass < 2 && !count; ++pass)
+	{
+		for (n = 1; n <= n_formats; ++n)
+		{
+			GlctxConfigInfo *info = &infos[count];
+			int generic;
+
+			if (!glctx_describe_format(ctx, get_attribs, n, info, &generic) ||
+					generic != pass)
+			{
+				continue;
+			}
+			if (info->red_size < min_sizes[GLCTX_CFG_RED_SIZE] ||
+					info->green_size < min_sizes[GLCTX_CFG_GREEN_SIZE] ||
+					info->blue_size < min_sizes[GLCTX_CFG_BLUE_SIZE] ||
+					info->alpha_size < min_sizes[GLCTX_CFG_ALPHA_SIZE] ||
+					info->depth_size < min_sizes[GLCTX_CFG_DEPTH_SIZE] ||
+					info->stencil_size < min_sizes[GLCTX_CFG_STENCIL_SIZE])
+			{
+				continue;
+			}
+			++count;
+		}
+	}
+	if (!count)
+	{
+		free(infos);
+		return GLCTX_ERROR_CONFIG;
+	}
+	*pinfos = infos;
+	*pcount = count;
+	return GLCTX_ERROR_NONE;
+}
+
+GlctxError glctx_get_config_by_id(GlctxHandle ctx, int id,
+        GlctxConfig *cfg_out)
+{
+	PIXELFORMATDESCRIPTOR pfd;
+
+	if (!DescribePixelFormat(ctx->dpy, id, sizeof(PIXELFORMATDESCRIPTOR),
+			&pfd))
+	{
+		return GLCTX_ERROR_CONFIG;
+	}
+	*cfg_out = id;
+	return GLCTX_ERROR_NONE;
+}
+
+void glctx__describe_driver(GlctxHandle ctx, char *buf, size_t size)
+{
+	DISPLAY_DEVICEA dd;
+
+	/* There are no driver strings until there's a context */
+	memset(&dd, 0, sizeof(dd));
+	dd.cb = sizeof(dd);
+	if (!EnumDisplayDevicesA(NULL, 0, &dd, 0))
+		dd.DeviceString[0] = 0;
+	snprintf(buf, size, "WGL|%s|%d|%d|%d.%d", dd.DeviceString,
+			DescribePixelFormat(ctx->dpy, 1, 0, NULL),
+			ctx->profile, ctx->maj_version, ctx->min_version);
+}
+
+typedef const char *(__stdcall *wglGetExtensionsStringARBProc)(HDC);
+typedef const char *(__stdcall *wglGetExtensionsStringEXTProc)(void);
+
+/* wglGetExtensionsString* can only be found with a current context */
+int glctx__get_native_extensions(GlctxHandle ctx,
+        const char **strings, int max)
+{
+	wglGetExtensionsStringARBProc wglGetExtensionsStringARB =
+			(wglGetExtensionsStringARBProc)
+			wglGetProcAddress("wglGetExtensionsStringARB");
+	wglGetExtensionsStringEXTProc wglGetExtensionsStringEXT =
+			(wglGetExtensionsStringEXTProc)
+			wglGetProcAddress("wglGetExtensionsStringEXT");
+
+	if (!wglGetCurrentContext())
+		return -1;
+	if (max < 1)
+		return 0;
+	if (wglGetExtensionsStringARB)
+		strings[0] = wglGetExtensionsStringARB(ctx->dpy);
+	else if (wglGetExtensionsStringEXT)
+		strings[0] = wglGetExtensionsStringEXT();
+	else
+		strings[0] = NULL;
+	return strings[0] ? 1 : 0;
+}
+
+void glctx_set_context_flags(GlctxHandle ctx, int flags)
+{
+    ctx->flags = glctx__check_context_flags(flags);
+}
+
+/* A context must be current. attrs must have room for 15 values. */
+static void glctx_make_context_attrs(GlctxHandle ctx, int *attrs)
+{
+	int flag_bits = 0;
+	int n = 0;
+
+	attrs[n++] = 0x9126;	/* WGL_CONTEXT_PROFILE_MASK_ARB */
+	attrs[n++] = glctx__profile_table[ctx->profile];
+	attrs[n++] = 0x2091;	/* WGL_CONTEXT_MAJOR_VERSION_ARB */
+	attrs[n++] = ctx->maj_version;
+	attrs[n++] = 0x2092;	/* WGL_CONTEXT_MINOR_VERSION_ARB */
+	attrs[n++] = ctx->min_version;
+	if (ctx->flags & GLCTX_CONTEXT_DEBUG)
+		flag_bits |= 0x0001;	/* WGL_CONTEXT_DEBUG_BIT_ARB */
+	if (ctx->flags & GLCTX_CONTEXT_ROBUST)
+	{
+		if (glctx_has_extension(ctx, "WGL_ARB_create_context_robustness"))
+		{
+			flag_bits |= 0x0004;	/* WGL_CONTEXT_ROBUST_ACCESS_BIT_ARB */
+			attrs[n++] = 0x8256;	/* WGL_CONTEXT_RESET_NOTIFICATION_... */
+			attrs[n++] = 0x8252;	/* WGL_LOSE_CONTEXT_ON_RESET_ARB */
+		}
+		else
+		{
+			glctx__log("glctx: Robust contexts not supported\n");
+		}
+	}
+	if (flag_bits)
+	{
+		attrs[n++] = 0x2094;	/* WGL_CONTEXT_FLAGS_ARB */
+		attrs[n++] = flag_bits;
+	}
+	if (ctx->flags & GLCTX_CONTEXT_NO_ERROR)
+	{
+		if (glctx_has_extension(ctx, "WGL_ARB_create_context_no_error"))
+		{
+			attrs[n++] = 0x31B3;	/* WGL_CONTEXT_OPENGL_NO_ERROR_ARB */
+			attrs[n++] = TRUE;
+		}
+		else
+		{
+			glctx__log("glctx: No-error contexts not supported\n");
+		}
+	}
+	if (ctx->flags & GLCTX_CONTEXT_NO_FLUSH)
+	{
+		if (glctx_has_extension(ctx, "WGL_ARB_context_flush_control"))
+		{
+			attrs[n++] = 0x2097;	/* WGL_CONTEXT_RELEASE_BEHAVIOR_ARB */
+			attrs[n++] = 0;		/* WGL_CONTEXT_RELEASE_BEHAVIOR_NONE_ARB */
+		}
+		else
+		{
+			glctx__log("glctx: Context flush control not supported\n");
+		}
+	}
+	attrs[n] = 0;
+}
+
+/* GetClientRect is answered locally, unlike X11's XGetWindowAttributes */
+static int glctx_get_window_size(HWND window, int *width, int *height)
+{
+	RECT rect;
+
+	if (!window || !GetClientRect(window, &rect))
+		return 0;
+	*width = rect.right - rect.left;
+	*height = rect.bottom - rect.top;
+	return 1;
+}
+
+static void glctx_init_size(HWND window, GlctxSizeCache *size)
+{
+	int width = 0, height = 0;
+
+	glctx_get_window_size(window, &width, &height);
+	glctx__set_size(size, width, height);
+}
 
 GlctxError glctx_activate(GlctxHandle ctx, GlctxConfig config,
         GlctxWindow window, const int *attrs)
@@ -149,6 +453,10 @@ GlctxError glctx_activate(GlctxHandle ctx, GlctxConfig config,
 		return GLCTX_ERROR_CONFIG;
 	}
 
+	if (!ctx->window)
+		ctx->window = WindowFromDC(ctx->dpy);
+	glctx_init_size(ctx->window, &ctx->size);
+
 	/* Get initial context */
 	fake_ctx = wglCreateContext(ctx->dpy);
 	if (!fake_ctx)
@@ -166,19 +474,15 @@ GlctxError glctx_activate(GlctxHandle ctx, GlctxConfig config,
 				wglGetProcAddress("wglCreateContextAttribsARB");
 	if (wglCreateContextAttribsARB)
 	{
-		int default_attrs[] = {
-			0x9126, glctx__profile_table[ctx->profile],
-			0x2091, ctx->maj_version,
-			0x2092, ctx->min_version,
-			0
-		};
-
+		glctx_make_context_attrs(ctx, ctx->context_attrs);
 		if (!attrs)
-			attrs = default_attrs;
+			attrs = ctx->context_attrs;
 		ctx->ctx = wglCreateContextAttribsARB(ctx->dpy, NULL, attrs);
 		if (ctx->ctx)
 		{
+			 ctx->create_context_attribs = wglCreateContextAttribsARB;
 			 wglMakeCurrent(ctx->dpy, NULL);
+			 glctx__set_current(NULL);
 			 wglDeleteContext(fake_ctx);
 			 result = glctx_bind(ctx);
 			 if (result)
@@ -195,42 +499,386 @@ GlctxError glctx_activate(GlctxHandle ctx, GlctxConfig config,
 	return GLCTX_ERROR_NONE;
 }
 
+GlctxError glctx_create_shared(GlctxHandle ctx, GlctxHandle *pctx)
+{
+    GlctxHandle worker;
+
+    *pctx = NULL;
+    if (!ctx->ctx)
+        return GLCTX_ERROR_CONTEXT;
+    worker = (GlctxHandle) malloc(sizeof(struct GlctxData_));
+    if (!worker)
+        return GLCTX_ERROR_MEMORY;
+    *worker = *ctx;
+    worker->surfaces = worker->draw = worker->read = NULL;
+    worker->dispatch = NULL;
+
+	/*
+	 * Workers use the parent's DC, which has the right pixel format. Only
+	 * parents that are old style contexts get old style workers.
+	 */
+	if (ctx->create_context_attribs)
+	{
+		worker->ctx = ctx->create_context_attribs(ctx->dpy, ctx->ctx,
+				ctx->context_attrs);
+	}
+	else
+	{
+		worker->ctx = wglCreateContext(ctx->dpy);
+		if (worker->ctx && !wglShareLists(ctx->ctx, worker->ctx))
+		{
+			glctx__log("glctx: wglShareLists failed (%ld)\n", GetLastError());
+			wglDeleteContext(worker->ctx);
+			worker->ctx = NULL;
+		}
+	}
+	if (!worker->ctx)
+	{
+		glctx__log("glctx: Unable to create shared WGL context\n");
+		free(worker);
+		return GLCTX_ERROR_CONTEXT;
+	}
+    *pctx = worker;
+    return GLCTX_ERROR_NONE;
+}
+
+typedef HANDLE (__stdcall *wglCreatePbufferARBProc)
+        (HDC, int, int, int, const int *);
+typedef HDC (__stdcall *wglGetPbufferDCARBProc)(HANDLE);
+typedef int (__stdcall *wglReleasePbufferDCARBProc)(HANDLE, HDC);
+typedef BOOL (__stdcall *wglDestroyPbufferARBProc)(HANDLE);
+typedef BOOL (__stdcall *wglMakeContextCurrentARBProc)(HDC, HDC, HGLRC);
+
+static GlctxError glctx_add_surface(GlctxHandle ctx, HDC dc, HWND window,
+		HANDLE pbuffer, GlctxSurface *psurf)
+{
+	GlctxSurface surf = (GlctxSurface)
+			malloc(sizeof(struct GlctxSurfaceData_));
+
+	if (!surf)
+		return GLCTX_ERROR_MEMORY;
+	surf->dc = dc;
+	surf->window = window;
+	surf->pbuffer = pbuffer;
+	glctx_init_size(window, &surf->size);
+	surf->next = ctx->surfaces;
+	ctx->surfaces = surf;
+	*psurf = surf;
+	return GLCTX_ERROR_NONE;
+}
+
+GlctxError glctx_attach_window(GlctxHandle ctx,
+        GlctxWindow window, GlctxSurface *psurf)
+{
+	PIXELFORMATDESCRIPTOR pfd;
+	int format = GetPixelFormat(ctx->dpy);
+	GlctxError result;
+	HDC dc;
+
+	*psurf = NULL;
+	if (!ctx->ctx)
+		return GLCTX_ERROR_CONTEXT;
+	dc = GetDC(window);
+	if (!dc)
+	{
+		glctx__log("glctx: GetDC failed (%ld)\n", GetLastError());
+		return GLCTX_ERROR_WINDOW;
+	}
+	/* A window's pixel format can only be set once */
+	if (GetPixelFormat(dc) != format &&
+			(!DescribePixelFormat(dc, format,
+					sizeof(PIXELFORMATDESCRIPTOR), &pfd) ||
+			!SetPixelFormat(dc, format, &pfd)))
+	{
+		glctx__log("glctx: SetPixelFormat failed: %ld\n", GetLastError());
+		ReleaseDC(window, dc);
+		return GLCTX_ERROR_CONFIG;
+	}
+	result = glctx_add_surface(ctx, dc, window, NULL, psurf);
+	if (result)
+		ReleaseDC(window, dc);
+	return result;
+}
+
+GlctxError glctx_attach_pbuffer(GlctxHandle ctx,
+        int width, int height, GlctxSurface *psurf)
+{
+	const int pb_attrs[] = { 0 };
+	wglCreatePbufferARBProc wglCreatePbufferARB;
+	wglGetPbufferDCARBProc wglGetPbufferDCARB;
+	wglDestroyPbufferARBProc wglDestroyPbufferARB;
+	GlctxError result;
+	HANDLE pbuffer;
+	HDC dc;
+
+	*psurf = NULL;
+	if (!ctx->ctx)
+		return GLCTX_ERROR_CONTEXT;
+	wglCreatePbufferARB = (wglCreatePbufferARBProc)
+			wglGetProcAddress("wglCreatePbufferARB");
+	wglGetPbufferDCARB = (wglGetPbufferDCARBProc)
+			wglGetProcAddress("wglGetPbufferDCARB");
+	wglDestroyPbufferARB = (wglDestroyPbufferARBProc)
+			wglGetProcAddress("wglDestroyPbufferARB");
+	if (!glctx_has_extension(ctx, "WGL_ARB_pbuffer") ||
+			!wglCreatePbufferARB || !wglGetPbufferDCARB ||
+			!wglDestroyPbufferARB)
+	{
+		glctx__log("glctx: WGL_ARB_pbuffer not supported\n");
+		return GLCTX_ERROR_SURFACE;
+	}
+	if (width < 1)
+		width = 1;
+	if (height < 1)
+		height = 1;
+	pbuffer = wglCreatePbufferARB(ctx->dpy, GetPixelFormat(ctx->dpy),
+			width, height, pb_attrs);
+	dc = pbuffer ? wglGetPbufferDCARB(pbuffer) : NULL;
+	if (!dc)
+	{
+		glctx__log("glctx: Unable to create WGL pbuffer (%ld)\n",
+				GetLastError());
+		if (pbuffer)
+			wglDestroyPbufferARB(pbuffer);
+		return GLCTX_ERROR_SURFACE;
+	}
+	result = glctx_add_surface(ctx, dc, NULL, pbuffer, psurf);
+	if (result)
+		wglDestroyPbufferARB(pbuffer);
+	else
+		glctx__set_size(&(*psurf)->size, width, height);
+	return result;
+}
+
+static HDC glctx_get_dc(GlctxHandle ctx, GlctxSurface surf)
+{
+	return surf ? surf->dc : ctx->dpy;
+}
+
+GlctxSizeCache *glctx__get_size_cache(GlctxHandle ctx)
+{
+	return ctx->draw ? &ctx->draw->size : &ctx->size;
+}
+
+int glctx__query_size(GlctxHandle ctx, int *width, int *height)
+{
+	return glctx_get_window_size(ctx->draw ? ctx->draw->window : ctx->window,
+			width, height);
+}
+
+static GlctxError glctx_make_current(GlctxHandle ctx)
+{
+	HDC draw = glctx_get_dc(ctx, ctx->draw);
+	HDC read = glctx_get_dc(ctx, ctx->read);
+	BOOL ok;
+
+	if (draw == read)
+	{
+		ok = wglMakeCurrent(draw, ctx->ctx);
+	}
+	else
+	{
+		wglMakeContextCurrentARBProc wglMakeContextCurrentARB =
+				(wglMakeContextCurrentARBProc)
+				wglGetProcAddress("wglMakeContextCurrentARB");
+
+		if (!wglMakeContextCurrentARB)
+		{
+			glctx__log("glctx: WGL_ARB_make_current_read not supported\n");
+			return GLCTX_ERROR_UNSUPPORTED;
+		}
+		ok = wglMakeContextCurrentARB(draw, read, ctx->ctx);
+	}
+	if (!ok)
+	{
+		glctx__log("glctx: wglMakeCurrent failed (%ld)\n", GetLastError());
+		return GLCTX_ERROR_BIND;
+	}
+	glctx__set_current(ctx);
+	return GLCTX_ERROR_NONE;
+}
+
+GlctxError glctx_set_surfaces(GlctxHandle ctx,
+        GlctxSurface draw, GlctxSurface read)
+{
+	GlctxSurface old_draw = ctx->draw;
+	GlctxSurface old_read = ctx->read;
+	GlctxError result;
+
+	if (draw == old_draw && read == old_read)
+		return GLCTX_ERROR_NONE;
+	ctx->draw = draw;
+	ctx->read = read;
+	if (glctx_get_current() != ctx)
+		return GLCTX_ERROR_NONE;
+	result = glctx_make_current(ctx);
+	if (result)
+	{
+		ctx->draw = old_draw;
+		ctx->read = old_read;
+		glctx_make_current(ctx);
+	}
+	return result;
+}
+
+void glctx_detach_surface(GlctxHandle ctx, GlctxSurface surf)
+{
+	GlctxSurface *psurf;
+
+	if (!surf)
+		return;
+	if (ctx->draw == surf || ctx->read == surf)
+	{
+		glctx_set_surfaces(ctx, ctx->draw == surf ? NULL : ctx->draw,
+				ctx->read == surf ? NULL : ctx->read);
+	}
+	for (psurf = &ctx->surfaces; *psurf; psurf = &(*psurf)->next)
+	{
+		if (*psurf == surf)
+		{
+			*psurf = surf->next;
+			break;
+		}
+	}
+	if (surf->pbuffer)
+	{
+		wglReleasePbufferDCARBProc wglReleasePbufferDCARB =
+				(wglReleasePbufferDCARBProc)
+				wglGetProcAddress("wglReleasePbufferDCARB");
+		wglDestroyPbufferARBProc wglDestroyPbufferARB =
+				(wglDestroyPbufferARBProc)
+				wglGetProcAddress("wglDestroyPbufferARB");
+
+		if (wglReleasePbufferDCARB)
+			wglReleasePbufferDCARB(surf->pbuffer, surf->dc);
+		if (wglDestroyPbufferARB)
+			wglDestroyPbufferARB(surf->pbuffer);
+	}
+	else
+	{
+		ReleaseDC(surf->window, surf->dc);
+	}
+	free(surf);
+}
+
+/* WGL has no fences of its own, so GL sync objects are used */
+void *glctx__native_fence_insert(GlctxHandle ctx)
+{
+	(void) ctx;
+	return NULL;
+}
+
+GlctxError glctx__native_fence_wait(GlctxHandle ctx, void *sync,
+	    int gpu, long long timeout_ns)
+{
+	(void) ctx;
+	(void) sync;
+	(void) gpu;
+	(void) timeout_ns;
+	return GLCTX_ERROR_UNSUPPORTED;
+}
+
+void glctx__native_fence_destroy(GlctxHandle ctx, void *sync)
+{
+	(void) ctx;
+	(void) sync;
+}
+
 GlctxNativeContext glctx_get_native_context(GlctxHandle ctx)
 {
     return ctx->ctx;
 }
 
-#if 0
-int glctx_get_width(GlctxHandle ctx)
+GlctxDispatch **glctx__get_dispatch(GlctxHandle ctx)
+{
+    return &ctx->dispatch;
+}
+
+GlctxProc glctx__get_native_proc(const char *name)
 {
-    return ctx->width;
+	PROC proc = wglGetProcAddress(name);
+
+	/* wglGetProcAddress only knows extensions and GL > 1.1, and some
+	 * drivers return small integers instead of NULL on failure
+	 */
+	if ((INT_PTR) proc >= -1 && (INT_PTR) proc <= 3)
+		proc = GetProcAddress(GetModuleHandleA("opengl32.dll"), name);
+	return (GlctxProc) proc;
 }
 
-int glctx_get_height(GlctxHandle ctx)
+void glctx__get_display_key(GlctxHandle ctx, void **display, int *screen)
 {
-    return ctx->height;
+    *display = ctx->dpy;
+    *screen = 0;
 }
-#endif
 
 void glctx_flip(GlctxHandle ctx)
 {
-    SwapBuffers(ctx->dpy);
+    SwapBuffers(glctx_get_dc(ctx, ctx->draw));
+}
+
+/* WGL has no damage or buffer age extensions */
+void glctx_flip_damage(GlctxHandle ctx, const int *rects, int n)
+{
+	(void) rects;
+	(void) n;
+	glctx_flip(ctx);
+}
+
+GlctxError glctx_set_damage_region(GlctxHandle ctx, const int *rects, int n)
+{
+	(void) ctx;
+	(void) rects;
+	(void) n;
+	return GLCTX_ERROR_UNSUPPORTED;
+}
+
+int glctx_get_buffer_age(GlctxHandle ctx)
+{
+	(void) ctx;
+	return 0;
+}
+
+typedef BOOL (__stdcall *wglSwapIntervalEXTProc)(int);
+
+GlctxError glctx_set_swap_interval(GlctxHandle ctx, int interval)
+{
+	wglSwapIntervalEXTProc wglSwapIntervalEXT = (wglSwapIntervalEXTProc)
+			wglGetProcAddress("wglSwapIntervalEXT");
+	if (!wglSwapIntervalEXT)
+	{
+		glctx__log("glctx: WGL_EXT_swap_control not supported\n");
+		return GLCTX_ERROR_UNSUPPORTED;
+	}
+	if (interval < 0 &&
+			!glctx_has_extension(ctx, "WGL_EXT_swap_control_tear"))
+	{
+		glctx__log("glctx: Adaptive vsync not supported\n");
+		interval = 1;
+	}
+	if (!wglSwapIntervalEXT(interval))
+	{
+		glctx__log("glctx: wglSwapIntervalEXT failed (%ld)\n",
+				GetLastError());
+		return GLCTX_ERROR_SURFACE;
+	}
+	return GLCTX_ERROR_NONE;
 }
 
 GlctxError glctx_unbind(GlctxHandle ctx)
 {
+    if (glctx_get_current() != ctx)
+        return GLCTX_ERROR_NONE;
     wglMakeCurrent(ctx->dpy, NULL);
+    glctx__set_current(NULL);
     return GLCTX_ERROR_NONE;
 }
 
 GlctxError glctx_bind(GlctxHandle ctx)
 {
-    if (!wglMakeCurrent(ctx->dpy, ctx->ctx))
-	{
-		glctx__log("glctx: wglMakeCurrent failed (%ld)\n", GetLastError());
-		return GLCTX_ERROR_BIND;
-	}
-    return GLCTX_ERROR_NONE;
+    if (glctx_get_current() == ctx)
+        return GLCTX_ERROR_NONE;
+    return glctx_make_current(ctx);
 }
 
 void glctx_terminate(GlctxHandle ctx)
@@ -243,6 +891,9 @@ void glctx_terminate(GlctxHandle ctx)
             wglDeleteContext(ctx->ctx);
             ctx->ctx = NULL;
         }
+        while (ctx->surfaces)
+            glctx_detach_surface(ctx, ctx->surfaces);
     }
+    glctx__free_dispatch(ctx->dispatch);
     free(ctx);
 }
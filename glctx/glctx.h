@@ -62,7 +62,10 @@ typedef enum {
     GLCTX_ERROR_SURFACE,    /* Unable to set up GL surface */
     GLCTX_ERROR_CONTEXT,    /* Unable to create OpenGL context */
     GLCTX_ERROR_BIND,       /* Unable to bind context to current thread */
-    GLCTX_ERROR_PROFILE     /* Unable to bind profile rendering type */
+    GLCTX_ERROR_PROFILE,    /* Unable to bind profile rendering type */
+    GLCTX_ERROR_UNSUPPORTED,/* Feature not supported by driver/backend */
+    GLCTX_ERROR_TIMEOUT,    /* Timed out waiting for a fence */
+    GLCTX_ERROR_BUSY        /* Render thread's queue is full */
 } GlctxError;
 
 
@@ -92,6 +95,21 @@ typedef enum {
     GLCTX_PROFILE_COMPAT        /* OpenGL */
 } GlctxProfile;
 
+/*
+ * GlctxContextFlags
+ * Portable context creation flags, may be ORed together. Each is ignored
+ * (with a log message) if the driver lacks the necessary extension.
+ */
+typedef enum {
+    GLCTX_CONTEXT_DEBUG = 1,        /* Debug context */
+    GLCTX_CONTEXT_ROBUST = 2,       /* Robust buffer access, lose context
+                                       on reset */
+    GLCTX_CONTEXT_NO_ERROR = 4,     /* KHR_no_error, no error checking;
+                                       ignored with DEBUG or ROBUST */
+    GLCTX_CONTEXT_NO_FLUSH = 8      /* Don't flush when the context is
+                                       released (*_context_flush_control) */
+} GlctxContextFlags;
+
 /*
  * GlctxLogFunction
  * Prototype of a function to log messages from glcontext.
@@ -125,7 +143,9 @@ const char GLCTX_EXPORT *glctx_get_error_name(GlctxError err);
  * glctx_init
  * Initialise glcontext. If you are adding OpenGL to an existing window you
  * can pass in its handle here, which may help GLX get the right screen,
- * otherwise 0/NULL.
+ * otherwise 0/NULL. With EGL, handles on the same display share it; it's
+ * initialised by the first and terminated with the last. EGL picks the
+ * platform itself; use glctx_init_platform to choose it.
  *
  * display:     Native display
  * window:      Native window or 0/NULL
@@ -138,9 +158,109 @@ GlctxError GLCTX_EXPORT glctx_init(GlctxDisplay display, GlctxWindow window,
         GlctxProfile profile, int maj_version, int min_version,
         GlctxHandle *pctx);
 
+/*
+ * glctx_init_headless
+ * Initialise glcontext for rendering without a window. With EGL the display
+ * comes from the EGL_MESA_platform_surfaceless platform if available, so no
+ * window system is needed at all. With GLX the default X display is opened
+ * and owned by the handle; XInitThreads is called first so its workers (see
+ * glctx_create_shared) can be used on other threads. Not supported with WGL.
+ *
+ * Configs are chosen for pbuffer rendering and glctx_activate ignores its
+ * window argument. EGL contexts are activated without a surface if the
+ * display supports EGL_KHR_surfaceless_context, otherwise (and always with
+ * GLX) a pbuffer of width x height is created; render to an FBO if you need
+ * a different size.
+ *
+ * width, height:   Size of the fallback pbuffer (<= 0 means 1)
+ */
+GlctxError GLCTX_EXPORT glctx_init_headless(GlctxProfile profile,
+        int maj_version, int min_version, int width, int height,
+        GlctxHandle *pctx);
+
+#if GLCTX_ENABLE_EGL
+/*
+ * GlctxDeviceInfo
+ * A GPU (or software renderer) that EGL can render on without a window
+ * system, as returned by glctx_enumerate_devices
+ */
+typedef struct {
+    int index;              /* For glctx_init_device */
+    int software;           /* Non-zero for EGL_MESA_device_software */
+    char drm_file[64];      /* eg /dev/dri/card0, empty if unknown */
+    char render_node[64];   /* eg /dev/dri/renderD128, empty if unknown */
+} GlctxDeviceInfo;
+
+/*
+ * glctx_enumerate_devices
+ * List the EGL devices (EGL_EXT_device_enumeration). Indices are stable for
+ * the life of the process. Free the array with glctx_free_devices.
+ *
+ * pinfos:      Array of *pcount devices (out)
+ * pcount:      Number of devices (out)
+ */
+GlctxError GLCTX_EXPORT glctx_enumerate_devices(GlctxDeviceInfo **pinfos,
+        int *pcount);
+
+/*
+ * glctx_free_devices
+ * Free an array returned by glctx_enumerate_devices
+ */
+void GLCTX_EXPORT glctx_free_devices(GlctxDeviceInfo *infos);
+
+/*
+ * glctx_init_device
+ * Like glctx_init_headless, but renders on the device with the given index
+ * from glctx_enumerate_devices (EGL_EXT_platform_device), eg to spread
+ * processes over several GPUs. Handles on the same device share a display.
+ */
+GlctxError GLCTX_EXPORT glctx_init_device(int index, GlctxProfile profile,
+        int maj_version, int min_version, int width, int height,
+        GlctxHandle *pctx);
+
+/*
+ * GlctxPlatform
+ * EGL platforms for glctx_init_platform, and what to pass as its display
+ * and window arguments
+ */
+typedef enum {
+    GLCTX_PLATFORM_DEFAULT,     /* eglGetDisplay, which guesses */
+    GLCTX_PLATFORM_X11,         /* Display *, Window */
+    GLCTX_PLATFORM_WAYLAND,     /* struct wl_display *, wl_egl_window * */
+    GLCTX_PLATFORM_GBM,         /* struct gbm_device *, gbm_surface * */
+    GLCTX_PLATFORM_SURFACELESS  /* Ignored; the handle is headless */
+} GlctxPlatform;
+
+/*
+ * glctx_init_platform
+ * Like glctx_init, but gets the display for an explicit platform with
+ * eglGetPlatformDisplayEXT instead of letting eglGetDisplay probe for one,
+ * which may try to connect to X11 or Wayland servers. Returns
+ * GLCTX_ERROR_UNSUPPORTED if the platform isn't available rather than
+ * falling back to another. Surfaceless handles are as for
+ * glctx_init_headless with a 1x1 fallback pbuffer.
+ *
+ * display:     Native display for the platform, or NULL for its default
+ * window:      Native window (cast to GlctxWindow) or 0/NULL
+ */
+GlctxError GLCTX_EXPORT glctx_init_platform(GlctxPlatform platform,
+        void *display, GlctxWindow window,
+        GlctxProfile profile, int maj_version, int min_version,
+        GlctxHandle *pctx);
+#endif
+
+/*
+ * glctx_set_context_flags
+ * Set GlctxContextFlags for contexts created by glctx_activate and
+ * glctx_create_shared. Call it before glctx_activate. Has no effect if
+ * native attrs are passed to glctx_activate.
+ */
+void GLCTX_EXPORT glctx_set_context_flags(GlctxHandle ctx, int flags);
+
 /*
  * glctx_get_config
- * Get best matching GL config
+ * Get best matching GL config, preferring the smallest sufficient bit depths
+ * and no multisampling (see glctx_choose_config)
  *
  * ctx:             The context to shut down
  * cfg_out:         A config is returned here
@@ -162,6 +282,125 @@ GlctxError GLCTX_EXPORT glctx_get_config(GlctxHandle ctx, GlctxConfig *cfg_out,
 int GLCTX_EXPORT glctx_query_config(GlctxHandle ctx, GlctxConfig config,
         GlctxAttr attr);
 
+/*
+ * GlctxConfigInfo
+ * A config with its attributes, as returned by glctx_enumerate_configs
+ */
+typedef struct {
+    GlctxConfig config;
+    int id;             /* EGL_CONFIG_ID, GLX_FBCONFIG_ID or WGL format */
+    int red_size;
+    int green_size;
+    int blue_size;
+    int alpha_size;
+    int depth_size;
+    int stencil_size;
+    int samples;        /* 0 if not multisampled */
+    int srgb;           /* Non-zero if sRGB rendering is possible */
+    int double_buffer;
+} GlctxConfigInfo;
+
+/*
+ * glctx_enumerate_configs
+ * Get all configs matching attrs (see glctx_get_config) with their
+ * attributes, fetched once so they can be compared without further calls
+ * to the driver. Free the array with glctx_free_configs.
+ *
+ * WGL can only use WGL_ARB_pixel_format while some context is current on
+ * the calling thread. Otherwise it falls back to legacy pixel format
+ * descriptors, which don't include multisampled formats and report samples
+ * and srgb as 0.
+ *
+ * pinfos:      Array of *pcount configs (out)
+ * pcount:      Number of configs (out)
+ */
+GlctxError GLCTX_EXPORT glctx_enumerate_configs(GlctxHandle ctx,
+        const int *attrs, int native_attrs,
+        GlctxConfigInfo **pinfos, int *pcount);
+
+/*
+ * glctx_free_configs
+ * Free an array returned by glctx_enumerate_configs
+ */
+void GLCTX_EXPORT glctx_free_configs(GlctxConfigInfo *infos);
+
+/*
+ * GlctxConfigWeights
+ * Penalties used to score configs, see glctx_score_config. Lower scores are
+ * better, so larger weights make a mismatch more important.
+ */
+typedef struct {
+    int color;          /* Per bit of RGB away from requested (8 if unset) */
+    int alpha;          /* Per bit of alpha above requested */
+    int depth;          /* Per bit of depth above requested */
+    int stencil;        /* Per bit of stencil above requested */
+    int samples;        /* Per sample away from requested */
+    int single_buffer;  /* If the config isn't double-buffered */
+} GlctxConfigWeights;
+
+/*
+ * glctx_get_default_config_weights
+ * Get the weights used when NULL is passed to glctx_choose_config, which
+ * prefer the smallest sufficient bit depths, the exact sample count and
+ * double buffering. Use this to initialise weights before tweaking them.
+ */
+void GLCTX_EXPORT glctx_get_default_config_weights(
+        GlctxConfigWeights *weights);
+
+/*
+ * glctx_score_config
+ * Score a config against the GlctxAttr sizes in attrs (as for
+ * glctx_get_config, NULL for none) and a sample count (0 for no MSAA).
+ * Lower is better; 0 is a perfect match.
+ */
+int GLCTX_EXPORT glctx_score_config(const GlctxConfigInfo *info,
+        const int *attrs, int samples, const GlctxConfigWeights *weights);
+
+/*
+ * glctx_choose_config
+ * Get the lowest scoring config of those matching attrs. The same scoring
+ * is used by all backends. glctx_get_config is equivalent to this with
+ * samples 0 and default weights. Where configs score equally the
+ * implementation's preferred order wins.
+ *
+ * samples:     Requested number of MSAA samples, 0 for none
+ * weights:     Scoring weights or NULL for defaults
+ */
+GlctxError GLCTX_EXPORT glctx_choose_config(GlctxHandle ctx,
+        GlctxConfig *cfg_out, const int *attrs, int native_attrs,
+        int samples, const GlctxConfigWeights *weights);
+
+/*
+ * glctx_get_config_by_id
+ * Get a config from its id (see GlctxConfigInfo) without a full search
+ */
+GlctxError GLCTX_EXPORT glctx_get_config_by_id(GlctxHandle ctx, int id,
+        GlctxConfig *cfg_out);
+
+/*
+ * glctx_set_config_cache
+ * Enables a persistent cache of the configs chosen by glctx_choose_config
+ * and glctx_get_config, stored in a text file at path, or disables it if
+ * path is NULL (the default). Entries are keyed by the backend's vendor and
+ * version strings, the renderer or device identity (EGL device and platform,
+ * GLX_MESA_query_renderer, and GL_RENDERER and GL_VERSION if the handle is
+ * current), the profile and GL version passed to glctx_init, and the
+ * arguments to glctx_choose_config. A cache hit costs a lookup by config id,
+ * and the config is re-scored and falls back to a full search if it no
+ * longer matches. The file is rewritten when an entry is added, keeping
+ * only the newest 256 entries. It may be shared by several processes,
+ * though an entry may be lost if two of them add one at once. Like
+ * glctx_set_log_function, call this before creating handles.
+ */
+GlctxError GLCTX_EXPORT glctx_set_config_cache(const char *path);
+
+/*
+ * glctx_config_info_attr
+ * Get a GlctxAttr value from a GlctxConfigInfo, or -1 for a bad attr
+ */
+int GLCTX_EXPORT glctx_config_info_attr(const GlctxConfigInfo *info,
+        GlctxAttr attr);
+
 /*
  * glctx_activate
  * Activate a context with a given config in a given window. On Windows and
@@ -175,6 +414,431 @@ int GLCTX_EXPORT glctx_query_config(GlctxHandle ctx, GlctxConfig config,
 GlctxError GLCTX_EXPORT glctx_activate(GlctxHandle ctx, GlctxConfig config,
         GlctxWindow window, const int *attrs);
 
+/*
+ * GlctxSurface
+ * An extra window or pbuffer surface attached to a handle, so one context
+ * (and one copy of its resources) can render to several targets. Surfaces
+ * belong to the handle that created them and are destroyed with it.
+ */
+typedef struct GlctxSurfaceData_ *GlctxSurface;
+
+/*
+ * glctx_attach_window
+ * Create a surface for another window, which must match the handle's config.
+ * Call after glctx_activate. Not supported on RPi.
+ *
+ * psurf:       The surface (out)
+ */
+GlctxError GLCTX_EXPORT glctx_attach_window(GlctxHandle ctx,
+        GlctxWindow window, GlctxSurface *psurf);
+
+/*
+ * glctx_attach_pbuffer
+ * Create an offscreen surface of width x height. Call after glctx_activate;
+ * fails with GLCTX_ERROR_SURFACE if the config can't make pbuffers.
+ *
+ * psurf:       The surface (out)
+ */
+GlctxError GLCTX_EXPORT glctx_attach_pbuffer(GlctxHandle ctx,
+        int width, int height, GlctxSurface *psurf);
+
+/*
+ * glctx_set_surfaces
+ * Choose the surfaces used for drawing and reading (eg glReadPixels, and
+ * glBlitFramebuffer from the default framebuffer). NULL means the handle's
+ * own window or headless surface. Takes effect immediately if the handle is
+ * bound, otherwise at the next glctx_bind. glctx_flip swaps the draw
+ * surface. Using different draw and read surfaces with WGL requires
+ * WGL_ARB_make_current_read.
+ */
+GlctxError GLCTX_EXPORT glctx_set_surfaces(GlctxHandle ctx,
+        GlctxSurface draw, GlctxSurface read);
+
+/*
+ * glctx_detach_surface
+ * Destroy an attached surface. If it's in use, the handle's own surface is
+ * used instead.
+ */
+void GLCTX_EXPORT glctx_detach_surface(GlctxHandle ctx, GlctxSurface surf);
+
+/*
+ * glctx_create_shared
+ * Create a worker handle whose context shares textures, buffers, shaders etc
+ * with ctx's, which must have been activated. The worker uses the same
+ * display and config, is not bound to any thread, and can be bound with
+ * glctx_bind on a thread of your choice. EGL workers are surfaceless or use
+ * a small pbuffer; if ctx's config can't make pbuffers, one with the same
+ * sizes is used instead, or GLCTX_ERROR_CONFIG is returned if there's no
+ * such config. GLX workers use a small pbuffer if the config allows,
+ * otherwise ctx's drawable; WGL workers use ctx's DC and the context
+ * attributes ctx was created with, so they can be created from any thread.
+ *
+ * GLX workers share ctx's X display connection. If you passed your own
+ * Display to glctx_init and bind workers on other threads, it must have
+ * been opened after XInitThreads (the default from libX11 1.8); displays
+ * opened by glctx_init_headless already are.
+ *
+ * Terminate workers before their parent.
+ */
+GlctxError GLCTX_EXPORT glctx_create_shared(GlctxHandle ctx,
+        GlctxHandle *pctx);
+
+/*
+ * glctx_create_shared_contexts
+ * Create n workers with glctx_create_shared. On failure, any workers already
+ * created are terminated.
+ *
+ * workers:     Array of n handles (out)
+ */
+GlctxError GLCTX_EXPORT glctx_create_shared_contexts(GlctxHandle ctx, int n,
+        GlctxHandle *workers);
+
+/*
+ * GlctxPool
+ * A set of workers created in advance with glctx_create_shared, so that
+ * handing one to a job doesn't include the cost of creating a context.
+ * Acquiring and releasing are lock-free and may be called from any thread.
+ */
+typedef struct GlctxPool_ *GlctxPool;
+
+/*
+ * glctx_pool_create
+ * Create size workers sharing with ctx, which must have been activated.
+ * With GLX all the workers, including any created by glctx_pool_acquire on
+ * other threads, use ctx's X display connection, so it must have been
+ * opened after XInitThreads (see glctx_create_shared).
+ *
+ * ppool:       The pool (out)
+ */
+GlctxError GLCTX_EXPORT glctx_pool_create(GlctxHandle ctx, int size,
+        GlctxPool *ppool);
+
+/*
+ * glctx_pool_acquire
+ * Take a worker from the pool and bind it to the calling thread. If the pool
+ * is empty a new worker is created, which is slow. Only the binding is
+ * reset between users, so don't rely on other GL state.
+ *
+ * pctx:        The worker (out)
+ */
+GlctxError GLCTX_EXPORT glctx_pool_acquire(GlctxPool pool, GlctxHandle *pctx);
+
+/*
+ * glctx_pool_release
+ * Unbind a worker from the calling thread and return it to the pool. Extra
+ * workers created by glctx_pool_acquire are terminated if the pool is full.
+ */
+void GLCTX_EXPORT glctx_pool_release(GlctxPool pool, GlctxHandle ctx);
+
+/*
+ * glctx_pool_destroy
+ * Terminate the pool's workers. Release acquired workers first, and destroy
+ * the pool before terminating its parent handle.
+ */
+void GLCTX_EXPORT glctx_pool_destroy(GlctxPool pool);
+
+/*
+ * GlctxFence
+ * Marks a point in a context's command stream, so other contexts or threads
+ * can wait for the GPU to get there instead of calling glFinish. EGL uses
+ * EGL_KHR_fence_sync, which works between any contexts on the display;
+ * otherwise GL_ARB_sync (or GL 3.2/GLES 3.0) is used, which only works
+ * within a share group (see glctx_create_shared).
+ */
+typedef struct GlctxFenceData_ *GlctxFence;
+
+/*
+ * glctx_fence_insert
+ * Insert a fence after the commands issued so far by ctx, which must be bound
+ * to the current thread, and flush them.
+ *
+ * pfence:      The fence (out)
+ */
+GlctxError GLCTX_EXPORT glctx_fence_insert(GlctxHandle ctx,
+        GlctxFence *pfence);
+
+/*
+ * glctx_fence_wait
+ * Wait for a fence from ctx, which must be bound to the current thread. If
+ * gpu is non-zero ctx's later commands wait on the GPU and this returns
+ * immediately (falling back to a CPU wait without EGL_KHR_wait_sync).
+ * Otherwise the thread blocks for up to timeout_ns, or forever if it's
+ * negative, and returns GLCTX_ERROR_TIMEOUT if the fence wasn't reached.
+ */
+GlctxError GLCTX_EXPORT glctx_fence_wait(GlctxHandle ctx, GlctxFence fence,
+        int gpu, long long timeout_ns);
+
+/*
+ * glctx_fence_poll
+ * Returns non-zero if the fence has been reached, without blocking. Also
+ * returns non-zero on errors, so a polling loop won't hang.
+ */
+int GLCTX_EXPORT glctx_fence_poll(GlctxHandle ctx, GlctxFence fence);
+
+/*
+ * glctx_fence_destroy
+ * Free a fence. ctx can be any handle on the same display or share group.
+ * GL sync objects can only be deleted by a current context, so unless the
+ * fence is EGL_KHR_fence_sync ctx must be bound to the current thread.
+ */
+void GLCTX_EXPORT glctx_fence_destroy(GlctxHandle ctx, GlctxFence fence);
+
+/*
+ * GlctxRenderer
+ * Owns a handle on a dedicated render thread. Any thread can submit work
+ * through a bounded lock-free queue without blocking, and gets a token that
+ * can be checked or waited for.
+ */
+typedef struct GlctxRenderer_ *GlctxRenderer;
+typedef unsigned int GlctxToken;
+typedef void (*GlctxRenderFunc)(GlctxHandle ctx, void *data);
+
+/*
+ * glctx_renderer_start
+ * Start a render thread and bind ctx to it. ctx must have been activated
+ * and must not be bound to any other thread.
+ *
+ * queue_size:  Maximum number of pending items, rounded up to a power of 2
+ * prenderer:   The renderer (out)
+ */
+GlctxError GLCTX_EXPORT glctx_renderer_start(GlctxHandle ctx,
+        int queue_size, GlctxRenderer *prenderer);
+
+/*
+ * glctx_renderer_submit
+ * Queue func(ctx, data) to run on the render thread. Returns
+ * GLCTX_ERROR_BUSY instead of blocking if the queue is full.
+ *
+ * ptoken:      Token for the item (out), may be NULL
+ */
+GlctxError GLCTX_EXPORT glctx_renderer_submit(GlctxRenderer renderer,
+        GlctxRenderFunc func, void *data, GlctxToken *ptoken);
+
+/*
+ * glctx_renderer_flip
+ * Queue a glctx_flip. Check its token to limit the frames in flight.
+ */
+GlctxError GLCTX_EXPORT glctx_renderer_flip(GlctxRenderer renderer,
+        GlctxToken *ptoken);
+
+/*
+ * glctx_renderer_is_complete
+ * Returns non-zero if the item with this token, and all earlier ones, have
+ * run. Tokens stay valid for 2^31 submissions.
+ */
+int GLCTX_EXPORT glctx_renderer_is_complete(GlctxRenderer renderer,
+        GlctxToken token);
+
+/*
+ * glctx_renderer_wait
+ * Block until the item with this token has run
+ */
+void GLCTX_EXPORT glctx_renderer_wait(GlctxRenderer renderer,
+        GlctxToken token);
+
+/*
+ * glctx_renderer_stop
+ * Run the remaining items, unbind the handle and stop the thread. The
+ * handle is not terminated. Don't submit while stopping.
+ */
+void GLCTX_EXPORT glctx_renderer_stop(GlctxRenderer renderer);
+
+/*
+ * GlctxReadback
+ * Reads rendered frames back to the CPU without stalling, through a ring of
+ * pixel pack buffers guarded by fences. A frame is delivered once the GPU
+ * has finished copying it, normally one or two frames later. Needs OpenGL
+ * 3.0 or OpenGL ES 3.0.
+ */
+typedef struct GlctxReadback_ *GlctxReadback;
+
+typedef struct {
+    const void *pixels;     /* RGBA8 rows, bottom row first */
+    int width, height;
+    int stride;             /* Bytes per row */
+    unsigned int frame;     /* Counts captures from 0 */
+    double latency_us;      /* Time from capture to delivery */
+} GlctxReadbackFrame;
+
+/*
+ * GlctxReadbackFunc
+ * Receives a frame. pixels points into the mapped buffer, so it's only valid
+ * until the function returns.
+ */
+typedef void (*GlctxReadbackFunc)(const GlctxReadbackFrame *frame,
+        void *data);
+
+/*
+ * glctx_readback_create
+ * Create a ring of depth (at least 2) buffers for frames of width x height.
+ * ctx must be bound to the current thread, as it must be for the other
+ * readback functions; frames are delivered to func on that thread.
+ *
+ * prb:         The readback ring (out)
+ */
+GlctxError GLCTX_EXPORT glctx_readback_create(GlctxHandle ctx,
+        int width, int height, int depth,
+        GlctxReadbackFunc func, void *data, GlctxReadback *prb);
+
+/*
+ * glctx_readback_capture
+ * Start copying the bottom left width x height pixels of the current read
+ * framebuffer; call before glctx_flip. If the ring is full the oldest frame
+ * is waited for and delivered first. Leaves GL_PIXEL_PACK_BUFFER unbound.
+ */
+GlctxError GLCTX_EXPORT glctx_readback_capture(GlctxReadback rb);
+
+/*
+ * glctx_readback_poll
+ * Deliver the frames that are ready, without blocking. Returns how many.
+ */
+int GLCTX_EXPORT glctx_readback_poll(GlctxReadback rb);
+
+/*
+ * glctx_readback_flush
+ * Wait for and deliver all outstanding frames
+ */
+void GLCTX_EXPORT glctx_readback_flush(GlctxReadback rb);
+
+/*
+ * glctx_readback_destroy
+ * Free the ring, discarding outstanding frames
+ */
+void GLCTX_EXPORT glctx_readback_destroy(GlctxReadback rb);
+
+/*
+ * GlctxFrameRing
+ * Exports frames to another process through a ring of slots in shared
+ * memory (a Linux memfd), using a GlctxReadback to fetch them. Pass the fd
+ * from glctx_frame_ring_get_fd to the consumer (eg over a unix socket),
+ * which maps it with glctx_frame_ring_map.
+ *
+ * The ring has one producer and one consumer. write_seq counts frames
+ * published and read_seq frames released by the consumer; frame n is in
+ * slot n % n_slots, whose seq is set to n + 1 once its pixels are complete.
+ * If the consumer falls behind, new frames are dropped rather than
+ * overwriting unreleased slots.
+ */
+typedef struct GlctxFrameRing_ *GlctxFrameRing;
+
+#define GLCTX_FRAME_RING_MAGIC 0x52464C47   /* "GLFR" */
+
+typedef struct {
+    unsigned int magic;
+    unsigned int n_slots;
+    unsigned int width, height;
+    unsigned int stride;            /* Bytes per row of RGBA8 pixels */
+    unsigned int slot_offset;       /* Offset of the first slot */
+    unsigned int slot_size;         /* Distance between slots */
+    unsigned int pixel_offset;      /* Offset of the pixels in a slot */
+    unsigned long long map_size;    /* Size of the shared memory */
+    volatile unsigned int write_seq;
+    volatile unsigned int read_seq;
+    volatile unsigned int dropped;  /* Frames dropped for lack of a slot */
+} GlctxFrameRingHeader;
+
+typedef struct {
+    volatile unsigned int seq;
+    unsigned int frame;             /* GlctxReadbackFrame.frame */
+} GlctxFrameSlot;
+
+/*
+ * glctx_frame_ring_create
+ * Create a ring of n_slots frames of width x height. ctx must be bound to
+ * the current thread. Returns GLCTX_ERROR_UNSUPPORTED if a slot would be
+ * 4GB or more.
+ *
+ * pring:       The ring (out)
+ */
+GlctxError GLCTX_EXPORT glctx_frame_ring_create(GlctxHandle ctx,
+        int width, int height, int n_slots, GlctxFrameRing *pring);
+
+/*
+ * glctx_frame_ring_get_fd
+ * The shared memory's file descriptor, owned by the ring
+ */
+int GLCTX_EXPORT glctx_frame_ring_get_fd(GlctxFrameRing ring);
+
+/*
+ * glctx_frame_ring_capture
+ * Capture the current read framebuffer as for glctx_readback_capture, and
+ * publish any earlier frames that have finished copying
+ */
+GlctxError GLCTX_EXPORT glctx_frame_ring_capture(GlctxFrameRing ring);
+
+/*
+ * glctx_frame_ring_flush
+ * Wait for and publish all captured frames
+ */
+void GLCTX_EXPORT glctx_frame_ring_flush(GlctxFrameRing ring);
+
+/*
+ * glctx_frame_ring_destroy
+ * Free the ring. Consumers' mappings remain valid.
+ */
+void GLCTX_EXPORT glctx_frame_ring_destroy(GlctxFrameRing ring);
+
+/*
+ * glctx_frame_ring_map
+ * Map a ring's shared memory in the consumer, which doesn't need a handle.
+ * Returns GLCTX_ERROR_UNSUPPORTED if fd isn't a frame ring or its header
+ * describes slots outside the shared memory.
+ *
+ * phdr:        The mapped ring (out)
+ */
+GlctxError GLCTX_EXPORT glctx_frame_ring_map(int fd,
+        GlctxFrameRingHeader **phdr);
+
+void GLCTX_EXPORT glctx_frame_ring_unmap(GlctxFrameRingHeader *hdr);
+
+/*
+ * glctx_frame_ring_peek
+ * Returns the oldest unreleased frame, or NULL if there isn't one. Its
+ * pixels (see glctx_frame_ring_get_pixels) stay valid and unchanged until
+ * glctx_frame_ring_release.
+ */
+const GlctxFrameSlot GLCTX_EXPORT *glctx_frame_ring_peek(
+        GlctxFrameRingHeader *hdr);
+
+const void GLCTX_EXPORT *glctx_frame_ring_get_pixels(
+        const GlctxFrameRingHeader *hdr, const GlctxFrameSlot *slot);
+
+/*
+ * glctx_frame_ring_release
+ * Release the frame returned by glctx_frame_ring_peek
+ */
+void GLCTX_EXPORT glctx_frame_ring_release(GlctxFrameRingHeader *hdr);
+
+/*
+ * GlctxProc
+ * Generic function pointer returned by glctx_get_proc_address
+ */
+typedef void (*GlctxProc)(void);
+
+/*
+ * glctx_get_proc_address
+ * Get an OpenGL(ES) function for use with ctx, eg "glDrawArrays". Each
+ * function is looked up (with eglGetProcAddress, glXGetProcAddressARB or
+ * wglGetProcAddress) the first time it's requested for a handle and cached
+ * in that handle's dispatch table, so only the functions you use are
+ * resolved and handles on different drivers don't interfere. Can be passed
+ * to loaders such as glad instead of using GLEW. With WGL the handle must be
+ * bound. Returns NULL if the function isn't available.
+ */
+GlctxProc GLCTX_EXPORT glctx_get_proc_address(GlctxHandle ctx,
+        const char *name);
+
+/*
+ * glctx_has_extension
+ * Returns non-zero if an extension is supported. Names starting with "GL_"
+ * are looked up in the context's GL extensions, which are indexed the first
+ * time one is queried while ctx is bound (0 is returned if it isn't bound
+ * yet). Other names are looked up in the window system's (EGL client and
+ * display, GLX or WGL) extensions. Each list is parsed into a hashed set
+ * only once, so this is cheap enough for hot paths.
+ */
+int GLCTX_EXPORT glctx_has_extension(GlctxHandle ctx, const char *name);
+
 /*
  * glctx_get_native_context
  * Gets the underlying EGL, GLX or WGL context
@@ -185,26 +849,212 @@ GlctxNativeContext GLCTX_EXPORT glctx_get_native_context(GlctxHandle ctx);
 EGLDisplay GLCTX_EXPORT glctx_get_egl_display(GlctxHandle ctx);
 
 EGLSurface GLCTX_EXPORT glctx_get_egl_surface(GlctxHandle ctx);
+
+/*
+ * GlctxImageCache
+ * Imports Linux dma-bufs (EGL_EXT_image_dma_buf_import) as GL textures
+ * without copying them, eg frames from a video decoder or camera. memfd
+ * buffers sealed with F_SEAL_SHRINK are turned into dma-bufs with
+ * /dev/udmabuf first.
+ *
+ * Each distinct buffer's EGLImage and texture are kept until the cache is
+ * full, when the least recently used one is recycled, so streaming from a
+ * fixed pool of buffers creates no EGL objects after the first pass. Buffers
+ * are recognised by the file their fds refer to rather than the fd number,
+ * so they may be passed with a different fd each time.
+ */
+typedef struct GlctxImageCache_ *GlctxImageCache;
+
+#define GLCTX_IMAGE_MAX_PLANES 4
+
+/* DRM_FORMAT_MOD_INVALID: let the driver work out the layout */
+#define GLCTX_IMAGE_NO_MODIFIER 0x00ffffffffffffffull
+
+typedef struct {
+    int fd;                 /* dma-buf or sealed memfd, owned by the caller */
+    unsigned int offset;    /* Bytes from the start of fd */
+    unsigned int pitch;     /* Bytes per row */
+} GlctxImagePlane;
+
+typedef struct {
+    int width, height;
+    unsigned int fourcc;            /* DRM_FORMAT_*, eg fourcc "NV12" */
+    unsigned long long modifier;    /* DRM format modifier */
+    int n_planes;
+    GlctxImagePlane planes[GLCTX_IMAGE_MAX_PLANES];
+    /*
+     * Bind to GL_TEXTURE_EXTERNAL_OES (GL_OES_EGL_image_external), which
+     * YUV formats usually need, instead of GL_TEXTURE_2D. Imports fail with
+     * GLCTX_ERROR_UNSUPPORTED if the context doesn't have the extension.
+     */
+    int external;
+} GlctxImageDesc;
+
+/*
+ * glctx_image_cache_create
+ * Create a cache of up to capacity images for ctx, which should be at
+ * least the number of buffers in the source's pool. The handle must be bound
+ * to the current thread. Returns GLCTX_ERROR_UNSUPPORTED unless EGL has
+ * EGL_EXT_image_dma_buf_import and the context has GL_OES_EGL_image.
+ *
+ * pcache:      The cache (out)
+ */
+GlctxError GLCTX_EXPORT glctx_image_cache_create(GlctxHandle ctx,
+        int capacity, GlctxImageCache *pcache);
+
+/*
+ * glctx_image_cache_import
+ * Get a texture showing the buffer described by desc, importing it if it
+ * isn't cached. The texture belongs to the cache and is only valid until
+ * the next import or evict. The handle must be bound to the current thread.
+ *
+ * ptexture:    GL texture name (out)
+ */
+GlctxError GLCTX_EXPORT glctx_image_cache_import(GlctxImageCache cache,
+        const GlctxImageDesc *desc, unsigned int *ptexture);
+
+/*
+ * glctx_image_cache_evict
+ * Forget images using the buffer fd refers to, eg before the source frees
+ * it. The handle must be bound to the current thread.
+ */
+void GLCTX_EXPORT glctx_image_cache_evict(GlctxImageCache cache, int fd);
+
+/*
+ * glctx_image_cache_destroy
+ * Free the cache and its images. The handle must be bound to the current
+ * thread.
+ */
+void GLCTX_EXPORT glctx_image_cache_destroy(GlctxImageCache cache);
 #endif
 
+#if GLCTX_ENABLE_GLX
+/*
+ * glctx_bind_pixmap
+ * Get a GL_TEXTURE_2D showing an X pixmap, eg another client's window from
+ * XCompositeNameWindowPixmap, without copying it through the client
+ * (GLX_EXT_texture_from_pixmap). The GLXPixmap and texture are kept until
+ * glctx_release_pixmap, so later calls for the same pixmap cost nothing
+ * unless glctx_pixmap_damaged has been called since. The handle must be
+ * bound to the current thread. The GL_TEXTURE_2D binding of the active
+ * texture unit is left as it was.
+ *
+ * ptexture:    GL texture name (out), owned by the handle
+ * py_inverted: Set to 1 if the texture's first row is the top of the
+ *              pixmap (GLX_Y_INVERTED_EXT), may be NULL
+ */
+GlctxError GLCTX_EXPORT glctx_bind_pixmap(GlctxHandle ctx, Pixmap pixmap,
+        unsigned int *ptexture, int *py_inverted);
+
+/*
+ * glctx_pixmap_damaged
+ * Mark a bound pixmap's contents as changed, eg on an XDamageNotify event,
+ * so the next glctx_bind_pixmap rebinds it
+ */
+void GLCTX_EXPORT glctx_pixmap_damaged(GlctxHandle ctx, Pixmap pixmap);
+
+/*
+ * glctx_release_pixmap
+ * Free the texture and GLXPixmap for a pixmap. Call this before freeing the
+ * pixmap (eg when the window is unmapped or resized). The handle must be
+ * bound to the current thread, otherwise nothing is freed and
+ * GLCTX_ERROR_BIND is returned. glctx_terminate releases any pixmaps that
+ * are left, binding the handle temporarily if necessary.
+ */
+GlctxError GLCTX_EXPORT glctx_release_pixmap(GlctxHandle ctx,
+        Pixmap pixmap);
+#endif
+
+/*
+ * glctx_get_width, glctx_get_height
+ * Size of the draw surface (see glctx_set_surfaces). These return a cached
+ * value without asking the window system, so they're cheap enough to call
+ * every frame; tell glcontext when a window is resized with
+ * glctx_notify_resize. Surfaceless EGL handles report the size passed to
+ * glctx_init_headless.
+ */
+int GLCTX_EXPORT glctx_get_width(GlctxHandle ctx);
+
+int GLCTX_EXPORT glctx_get_height(GlctxHandle ctx);
+
+/*
+ * glctx_notify_resize
+ * Update the draw surface's cached size, eg from an X ConfigureNotify event.
+ * If width or height is <= 0 the size is queried from the window system at
+ * the next glctx_get_width/height instead. May be called from any thread.
+ */
+void GLCTX_EXPORT glctx_notify_resize(GlctxHandle ctx, int width, int height);
+
 /*
  * glctx_flip
- * Flips buffers to display a rendered scene
+ * Flips buffers to display a rendered scene on the draw surface (see
+ * glctx_set_surfaces)
  */
 void GLCTX_EXPORT glctx_flip(GlctxHandle ctx);
 
+/*
+ * glctx_flip_damage
+ * Like glctx_flip, but tells the compositor that only n rectangles changed,
+ * using EGL_KHR/EXT_swap_buffers_with_damage. Falls back to glctx_flip.
+ *
+ * rects:       n groups of (x, y, width, height) in pixels, with the origin
+ *              at the bottom left like glViewport
+ */
+void GLCTX_EXPORT glctx_flip_damage(GlctxHandle ctx, const int *rects, int n);
+
+/*
+ * glctx_set_damage_region
+ * Tell the driver which rectangles of the draw surface the next frame will
+ * redraw, so it can skip loading the rest (EGL_KHR_partial_update). Call
+ * after glctx_get_buffer_age and before drawing. rects are as for
+ * glctx_flip_damage. Returns GLCTX_ERROR_UNSUPPORTED if the extension isn't
+ * available, which is harmless.
+ */
+GlctxError GLCTX_EXPORT glctx_set_damage_region(GlctxHandle ctx,
+        const int *rects, int n);
+
+/*
+ * glctx_get_buffer_age
+ * Returns how many frames old the draw surface's back buffer contents are,
+ * so only what changed since then needs to be redrawn; or 0 if the contents
+ * are undefined or EGL/GLX_EXT_buffer_age isn't supported. The handle must
+ * be bound to the current thread.
+ */
+int GLCTX_EXPORT glctx_get_buffer_age(GlctxHandle ctx);
+
+/*
+ * glctx_set_swap_interval
+ * Sets the number of vblanks to wait for in glctx_flip for the bound handle.
+ * 0 disables vsync, 1 is normal vsync and -1 requests adaptive vsync, which
+ * only waits if the frame wasn't late (GLX/WGL_EXT_swap_control_tear). If
+ * adaptive vsync isn't available 1 is used instead. EGL has no adaptive
+ * mode. The handle must be bound to the current thread.
+ */
+GlctxError GLCTX_EXPORT glctx_set_swap_interval(GlctxHandle ctx,
+        int interval);
+
 /*
  * glctx_unbind
- * Unbinds context from current thread
+ * Unbinds context from current thread. Does nothing if ctx isn't the
+ * thread's current handle.
  */
 GlctxError GLCTX_EXPORT glctx_unbind(GlctxHandle ctx);
 
 /*
  * glctx_bind
- * Binds context to current thread (only to be called after glctx_unbind)
+ * Binds context to current thread (only to be called after glctx_unbind).
+ * Does nothing if ctx is already the thread's current handle.
  */
 GlctxError GLCTX_EXPORT glctx_bind(GlctxHandle ctx);
 
+/*
+ * glctx_get_current
+ * Returns the handle bound to the current thread by glctx_bind or
+ * glctx_activate, or NULL. This is tracked by glcontext without calling the
+ * driver, so don't mix glctx_bind/unbind with native make-current calls.
+ */
+GlctxHandle GLCTX_EXPORT glctx_get_current(void);
+
 /*
  * glctx_terminate
  * Shut down a GL context
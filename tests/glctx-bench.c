@@ -0,0 +1,411 @@
+/*
+ * glctx-bench
+ * Measures the latency of glcontext's main entry points using headless
+ * contexts, so it runs on EGL surfaceless or under Xvfb. Results are written
+ * to stdout as JSON; log messages go to stderr with -v. Exits with 77 (a
+ * skip for CTest) if there's no display to run on.
+ *
+ * Usage: glctx-bench [-n iterations] [-gl | -gles] [-v]
+ */
+
+#include "glctx/glctx.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+/* Count allocations by interposing malloc and friends where glibc lets us */
+#if defined(__GLIBC__)
+#define BENCH_COUNT_ALLOCS 1
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static volatile long bench_allocs = 0;
+
+void *malloc(size_t size)
+{
+    __sync_fetch_and_add(&bench_allocs, 1);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+    __sync_fetch_and_add(&bench_allocs, 1);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    __sync_fetch_and_add(&bench_allocs, 1);
+    return __libc_realloc(ptr, size);
+}
+#else
+#define BENCH_COUNT_ALLOCS 0
+static long bench_allocs = 0;
+#endif
+
+static double bench_now_us(void)
+{
+#if defined(_WIN32)
+    LARGE_INTEGER freq, count;
+
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double) count.QuadPart * 1e6 / (double) freq.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec * 1e6 + (double) ts.tv_nsec / 1e3;
+#endif
+}
+
+typedef struct {
+    const char *name;
+    double *samples;
+    int n_samples;
+    long allocs;
+} BenchResult;
+
+#define BENCH_EXIT_SKIP 77
+
+static GlctxProfile bench_profile;
+static int bench_maj_version, bench_min_version;
+static int bench_iterations = 100;
+
+static int bench_log(const char *format, ...)
+{
+    va_list args;
+    int result;
+
+    va_start(args, format);
+    result = vfprintf(stderr, format, args);
+    va_end(args);
+    return result;
+}
+
+static void bench_fail(const char *what, GlctxError err)
+{
+    fprintf(stderr, "glctx-bench: %s failed: %s\n",
+            what, glctx_get_error_name(err));
+    exit(1);
+}
+
+static void bench_result_init(BenchResult *result, const char *name)
+{
+    result->name = name;
+    result->samples = malloc(sizeof(double) * bench_iterations);
+    result->n_samples = 0;
+    result->allocs = 0;
+    if (!result->samples)
+    {
+        fprintf(stderr, "glctx-bench: Out of memory\n");
+        exit(1);
+    }
+}
+
+static void bench_begin(double *t, long *allocs)
+{
+    *allocs = bench_allocs;
+    *t = bench_now_us();
+}
+
+static void bench_end(BenchResult *result, double t, long allocs)
+{
+    double t1 = bench_now_us();
+
+    result->allocs += bench_allocs - allocs;
+    result->samples[result->n_samples++] = t1 - t;
+}
+
+static GlctxHandle bench_init(void)
+{
+    GlctxHandle ctx;
+    GlctxError err = glctx_init_headless(bench_profile,
+            bench_maj_version, bench_min_version, 64, 64, &ctx);
+
+    if (err == GLCTX_ERROR_DISPLAY)
+    {
+        fprintf(stderr, "glctx-bench: No display, skipping\n");
+        exit(BENCH_EXIT_SKIP);
+    }
+    if (err)
+        bench_fail("glctx_init_headless", err);
+    return ctx;
+}
+
+static GlctxConfig bench_get_config(GlctxHandle ctx)
+{
+    static const int attrs[] = {
+        GLCTX_CFG_RED_SIZE, 8,
+        GLCTX_CFG_GREEN_SIZE, 8,
+        GLCTX_CFG_BLUE_SIZE, 8,
+        GLCTX_CFG_NONE
+    };
+    GlctxConfig config;
+    GlctxError err = glctx_get_config(ctx, &config, attrs, 0);
+
+    if (err)
+        bench_fail("glctx_get_config", err);
+    return config;
+}
+
+static void bench_activate(GlctxHandle ctx, GlctxConfig config)
+{
+    GlctxError err = glctx_activate(ctx, config, 0, NULL);
+
+    if (err)
+        bench_fail("glctx_activate", err);
+}
+
+static void run_init(BenchResult *result)
+{
+    int n;
+
+    bench_result_init(result, "init");
+    for (n = 0; n < bench_iterations; ++n)
+    {
+        GlctxHandle ctx;
+        double t;
+        long allocs;
+
+        bench_begin(&t, &allocs);
+        ctx = bench_init();
+        bench_end(result, t, allocs);
+        glctx_terminate(ctx);
+    }
+}
+
+static void run_get_config(BenchResult *result)
+{
+    GlctxHandle ctx = bench_init();
+    int n;
+
+    bench_result_init(result, "get_config");
+    for (n = 0; n < bench_iterations; ++n)
+    {
+        double t;
+        long allocs;
+
+        bench_begin(&t, &allocs);
+        bench_get_config(ctx);
+        bench_end(result, t, allocs);
+    }
+    glctx_terminate(ctx);
+}
+
+static void run_activate(BenchResult *result)
+{
+    int n;
+
+    bench_result_init(result, "activate");
+    for (n = 0; n < bench_iterations; ++n)
+    {
+        GlctxHandle ctx = bench_init();
+        GlctxConfig config = bench_get_config(ctx);
+        double t;
+        long allocs;
+
+        bench_begin(&t, &allocs);
+        bench_activate(ctx, config);
+        bench_end(result, t, allocs);
+        glctx_terminate(ctx);
+    }
+}
+
+static void run_bind_flip(BenchResult *bind_result, BenchResult *flip_result)
+{
+    GlctxHandle ctx = bench_init();
+    int n;
+
+    bench_activate(ctx, bench_get_config(ctx));
+    bench_result_init(bind_result, "unbind_bind");
+    bench_result_init(flip_result, "flip");
+    for (n = 0; n < bench_iterations; ++n)
+    {
+        double t;
+        long allocs;
+        GlctxError err;
+
+        bench_begin(&t, &allocs);
+        err = glctx_unbind(ctx);
+        if (!err)
+            err = glctx_bind(ctx);
+        bench_end(bind_result, t, allocs);
+        if (err)
+            bench_fail("glctx_unbind/glctx_bind", err);
+
+        bench_begin(&t, &allocs);
+        glctx_flip(ctx);
+        bench_end(flip_result, t, allocs);
+    }
+    glctx_terminate(ctx);
+}
+
+static void run_pool(BenchResult *result)
+{
+    GlctxHandle ctx = bench_init();
+    GlctxPool pool;
+    GlctxError err;
+    int n;
+
+    bench_activate(ctx, bench_get_config(ctx));
+    glctx_unbind(ctx);
+    err = glctx_pool_create(ctx, 4, &pool);
+    if (err)
+        bench_fail("glctx_pool_create", err);
+    bench_result_init(result, "pool_acquire_release");
+    for (n = 0; n < bench_iterations; ++n)
+    {
+        GlctxHandle worker;
+        double t;
+        long allocs;
+
+        bench_begin(&t, &allocs);
+        err = glctx_pool_acquire(pool, &worker);
+        if (!err)
+            glctx_pool_release(pool, worker);
+        bench_end(result, t, allocs);
+        if (err)
+            bench_fail("glctx_pool_acquire", err);
+    }
+    glctx_pool_destroy(pool);
+    glctx_terminate(ctx);
+}
+
+static void run_renderer(BenchResult *result)
+{
+    GlctxHandle ctx = bench_init();
+    GlctxRenderer renderer;
+    GlctxError err;
+    int n;
+
+    bench_activate(ctx, bench_get_config(ctx));
+    glctx_unbind(ctx);
+    err = glctx_renderer_start(ctx, 16, &renderer);
+    if (err)
+        bench_fail("glctx_renderer_start", err);
+    bench_result_init(result, "renderer_flip_submit");
+    for (n = 0; n < bench_iterations; ++n)
+    {
+        GlctxToken token;
+        double t;
+        long allocs;
+
+        bench_begin(&t, &allocs);
+        err = glctx_renderer_flip(renderer, &token);
+        bench_end(result, t, allocs);
+        if (err)
+            bench_fail("glctx_renderer_flip", err);
+        glctx_renderer_wait(renderer, token);
+    }
+    glctx_renderer_stop(renderer);
+    /* Fails if the render thread left the context current */
+    err = glctx_bind(ctx);
+    if (err)
+        bench_fail("glctx_bind after glctx_renderer_stop", err);
+    glctx_terminate(ctx);
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double da = *(const double *) a;
+    double db = *(const double *) b;
+
+    return (da > db) - (da < db);
+}
+
+static double percentile(const double *sorted, int n, int pc)
+{
+    int i = (n * pc + 99) / 100 - 1;
+
+    if (i < 0)
+        i = 0;
+    return sorted[i];
+}
+
+static void print_result(const BenchResult *result, int last)
+{
+    double *s = result->samples;
+    int n = result->n_samples;
+
+    qsort(s, n, sizeof(double), compare_doubles);
+    printf("    \"%s\": {\"p50_us\": %.2f, \"p99_us\": %.2f, "
+            "\"max_us\": %.2f, ", result->name,
+            percentile(s, n, 50), percentile(s, n, 99), s[n - 1]);
+    if (BENCH_COUNT_ALLOCS)
+        printf("\"allocs_per_iter\": %.2f}", (double) result->allocs / n);
+    else
+        printf("\"allocs_per_iter\": null}");
+    printf(last ? "\n" : ",\n");
+}
+
+int main(int argc, char **argv)
+{
+    BenchResult results[7];
+    int n_results = sizeof(results) / sizeof(results[0]);
+    int n;
+
+#if GLCTX_ENABLE_EGL
+    bench_profile = GLCTX_PROFILE_OPENGLES;
+#else
+    bench_profile = GLCTX_PROFILE_OPENGL;
+#endif
+    for (n = 1; n < argc; ++n)
+    {
+        if (!strcmp(argv[n], "-n") && n + 1 < argc)
+        {
+            bench_iterations = atoi(argv[++n]);
+        }
+        else if (!strcmp(argv[n], "-gl"))
+        {
+            bench_profile = GLCTX_PROFILE_OPENGL;
+        }
+        else if (!strcmp(argv[n], "-gles"))
+        {
+            bench_profile = GLCTX_PROFILE_OPENGLES;
+        }
+        else if (!strcmp(argv[n], "-v"))
+        {
+            glctx_set_log_function(bench_log);
+        }
+        else
+        {
+            fprintf(stderr,
+                    "Usage: %s [-n iterations] [-gl | -gles] [-v]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (bench_iterations < 1)
+        bench_iterations = 1;
+    bench_maj_version = 2;
+    bench_min_version = (bench_profile == GLCTX_PROFILE_OPENGLES) ? 0 : 1;
+
+    run_init(&results[0]);
+    run_get_config(&results[1]);
+    run_activate(&results[2]);
+    run_bind_flip(&results[3], &results[4]);
+    run_pool(&results[5]);
+    run_renderer(&results[6]);
+
+    printf("{\n");
+    printf("  \"backend\": \"%s\",\n", GLCTX_BACKEND_NAME);
+    printf("  \"profile\": \"%s\",\n",
+            (bench_profile == GLCTX_PROFILE_OPENGLES) ? "gles" : "gl");
+    printf("  \"iterations\": %d,\n", bench_iterations);
+    printf("  \"results\": {\n");
+    for (n = 0; n < n_results; ++n)
+        print_result(&results[n], n == n_results - 1);
+    printf("  }\n}\n");
+    for (n = 0; n < n_results; ++n)
+        free(results[n].samples);
+    return 0;
+}
@@ -0,0 +1,153 @@
+/*
+ * glctx-pixmap-test
+ * Checks glctx_bind_pixmap, rebinding after damage and glctx_release_pixmap
+ * with a headless GLX handle, eg under Xvfb. Exits with 77 (a skip for
+ * CTest) if there's no X display or GLX_EXT_texture_from_pixmap.
+ */
+
+#include "glctx/glctx.h"
+
+#include <GL/gl.h>
+#include <X11/Xlib.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TEST_EXIT_SKIP 77
+#define TEST_SIZE 16
+
+#ifndef GL_BGRA
+#define GL_BGRA 0x80E1
+#endif
+
+static void test_fail(const char *what)
+{
+    fprintf(stderr, "glctx-pixmap-test: %s\n", what);
+    exit(1);
+}
+
+static void test_skip(const char *why)
+{
+    fprintf(stderr, "glctx-pixmap-test: %s, skipping\n", why);
+    exit(TEST_EXIT_SKIP);
+}
+
+static void fill_pixmap(Display *dpy, Pixmap pixmap, unsigned long color)
+{
+    GC gc = XCreateGC(dpy, pixmap, 0, NULL);
+
+    XSetForeground(dpy, gc, color);
+    XFillRectangle(dpy, pixmap, gc, 0, 0, TEST_SIZE, TEST_SIZE);
+    XFreeGC(dpy, gc);
+    /* The handle has its own connection, so make sure the server has it */
+    XSync(dpy, False);
+}
+
+static GLint get_bound_texture(void)
+{
+    GLint texture = 0;
+
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+    return texture;
+}
+
+/* Checks the texture's first pixel is the pixmap's 0xRRGGBB color */
+static void check_color(unsigned int texture, unsigned long color)
+{
+    unsigned char pixels[TEST_SIZE * TEST_SIZE * 4];
+    GLint old_texture = get_bound_texture();
+
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_BGRA, GL_UNSIGNED_BYTE, pixels);
+    glBindTexture(GL_TEXTURE_2D, (GLuint) old_texture);
+    if (pixels[0] != (color & 0xff) || pixels[1] != ((color >> 8) & 0xff) ||
+            pixels[2] != ((color >> 16) & 0xff))
+    {
+        fprintf(stderr, "glctx-pixmap-test: Got %02x%02x%02x, "
+                "expected %06lx\n", pixels[2], pixels[1], pixels[0], color);
+        exit(1);
+    }
+}
+
+int main(void)
+{
+    GlctxHandle ctx;
+    GlctxConfig config;
+    GlctxError err;
+    Display *dpy;
+    Pixmap pixmap, pixmap2;
+    GLuint own_texture;
+    unsigned int texture, texture2;
+
+    err = glctx_init_headless(GLCTX_PROFILE_OPENGL, 2, 1, 1, 1, &ctx);
+    if (err == GLCTX_ERROR_DISPLAY)
+        test_skip("No display");
+    if (err)
+        test_fail("glctx_init_headless failed");
+    if (glctx_get_config(ctx, &config, NULL, 0) ||
+            glctx_activate(ctx, config, 0, NULL))
+    {
+        test_fail("Unable to activate handle");
+    }
+    dpy = XOpenDisplay(NULL);
+    if (!dpy)
+        test_fail("Unable to open a second X connection");
+    pixmap = XCreatePixmap(dpy, DefaultRootWindow(dpy), TEST_SIZE, TEST_SIZE,
+            DefaultDepth(dpy, DefaultScreen(dpy)));
+    pixmap2 = XCreatePixmap(dpy, DefaultRootWindow(dpy), TEST_SIZE, TEST_SIZE,
+            DefaultDepth(dpy, DefaultScreen(dpy)));
+    fill_pixmap(dpy, pixmap, 0xff8040);
+    fill_pixmap(dpy, pixmap2, 0x102030);
+
+    glGenTextures(1, &own_texture);
+    glBindTexture(GL_TEXTURE_2D, own_texture);
+    err = glctx_bind_pixmap(ctx, pixmap, &texture, NULL);
+    if (err == GLCTX_ERROR_UNSUPPORTED)
+        test_skip("GLX_EXT_texture_from_pixmap not supported");
+    if (err || !texture)
+        test_fail("glctx_bind_pixmap failed");
+    if (get_bound_texture() != (GLint) own_texture)
+        test_fail("glctx_bind_pixmap changed the texture binding");
+    check_color(texture, 0xff8040);
+
+    /* Undamaged pixmaps come straight from the cache */
+    if (glctx_bind_pixmap(ctx, pixmap, &texture2, NULL) ||
+            texture2 != texture)
+    {
+        test_fail("Rebinding an undamaged pixmap gave a new texture");
+    }
+
+    fill_pixmap(dpy, pixmap, 0x4080ff);
+    glctx_pixmap_damaged(ctx, pixmap);
+    if (glctx_bind_pixmap(ctx, pixmap, &texture2, NULL) ||
+            texture2 != texture)
+    {
+        test_fail("Rebinding a damaged pixmap failed");
+    }
+    if (get_bound_texture() != (GLint) own_texture)
+        test_fail("Rebinding changed the texture binding");
+    check_color(texture, 0x4080ff);
+
+    glctx_unbind(ctx);
+    if (glctx_release_pixmap(ctx, pixmap) != GLCTX_ERROR_BIND)
+        test_fail("glctx_release_pixmap didn't need the handle bound");
+    glctx_bind(ctx);
+    if (glctx_release_pixmap(ctx, pixmap))
+        test_fail("glctx_release_pixmap failed");
+    if (glIsTexture(texture))
+        test_fail("glctx_release_pixmap didn't delete the texture");
+
+    /* Left for glctx_terminate to release while unbound */
+    if (glctx_bind_pixmap(ctx, pixmap2, &texture2, NULL))
+        test_fail("glctx_bind_pixmap failed for a second pixmap");
+    check_color(texture2, 0x102030);
+    glDeleteTextures(1, &own_texture);
+    glctx_unbind(ctx);
+    glctx_terminate(ctx);
+
+    XFreePixmap(dpy, pixmap);
+    XFreePixmap(dpy, pixmap2);
+    XCloseDisplay(dpy);
+    printf("glctx-pixmap-test: OK\n");
+    return 0;
+}